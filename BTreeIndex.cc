@@ -10,10 +10,34 @@
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
 #include <iostream>
+#include <cstdio>
 #include <cstring>
+#include <climits>
+#include <unistd.h>
+#include <vector>
+#include <algorithm>
 
 using namespace std;
 
+// layout of the meta page (page 0):
+// [rootPid][treeHeight][META_MAGIC][IndexStats][includedSize][overflowPid][bloomBlocks]
+static const int META_MAGIC = 0x42545331; // "BTS1": the page carries IndexStats
+static const int META_MAGIC_OFFSET = sizeof(PageId) + sizeof(int);
+static const int META_STATS_OFFSET = META_MAGIC_OFFSET + sizeof(int);
+static const int META_LAYOUT_OFFSET = META_STATS_OFFSET + sizeof(IndexStats);
+
+// layout of the included value in a covering leaf entry:
+// [short length][value bytes]                  if it fits in the entry
+// [short length][PageId pid][int offset]       otherwise. the value is in
+//                                              the overflow pages at (pid, offset)
+// a value longer than SHRT_MAX has length LONG_VALUE, and its int length
+// comes before its bytes in the overflow pages.
+// layout of an overflow page: [PageId next][int used][value bytes ...]
+// a value that does not fit in the rest of a page continues on the next one.
+static const int OVERFLOW_HEADER = sizeof(PageId) + sizeof(int);
+static const int OVERFLOW_CAPACITY = PageFile::PAGE_SIZE - OVERFLOW_HEADER;
+static const short LONG_VALUE = -1;
+
 /*
  * BTreeIndex constructor
  */
@@ -21,6 +45,28 @@ BTreeIndex::BTreeIndex()
 {
   rootPid = -1;
   treeHeight = 0;
+  openMode = 'r';
+  memset(buffer, 0, PageFile::PAGE_SIZE);
+  memset(&stats, 0, sizeof(IndexStats));
+  statsValid = false;
+  statsDirty = false;
+  appendSplitPercent = APPEND_SPLIT_PERCENT;
+  rightmostPid = -1;
+  includedSize = 0;
+  overflowPid = -1;
+  bloomBlocks = 0;
+}
+
+/*
+ * The Bloom filter of "name.idx" is stored in "name.bf".
+ */
+static string sidecarName(const string& indexname)
+{
+  string::size_type dot = indexname.rfind(".idx");
+  if (dot != string::npos && dot + 4 == indexname.size()) {
+    return indexname.substr(0, dot) + ".bf";
+  }
+  return indexname + ".bf";
 }
 
 /*
@@ -38,6 +84,22 @@ RC BTreeIndex::open(const string& indexname, char mode)
     return rc;
   }
 
+  statsDirty = false;
+  rightmostPid = -1;
+  includedSize = 0;
+  overflowPid = -1;
+  bloomBlocks = 0;
+  indexName = indexname;
+  openMode = mode;
+  bloomName = sidecarName(indexname);
+  memset(&stats, 0, sizeof(IndexStats));
+
+  // a newly created index file does not have a meta page yet
+  if (pf.endPid() == 0) {
+    statsValid = true;
+    return 0;
+  }
+
   rc = pf.read(0, buffer); // use pid = 0 for reading rootPid/treeHeight from disk
   if (rc != 0) {
     return rc;
@@ -57,6 +119,23 @@ RC BTreeIndex::open(const string& indexname, char mode)
     treeHeight = height;
   }
 
+  // indexes written before statistics existed have no magic number
+  int magic;
+  memcpy(&magic, buffer + META_MAGIC_OFFSET, sizeof(int));
+  statsValid = (magic == META_MAGIC);
+  if (statsValid) {
+    memcpy(&stats, buffer + META_STATS_OFFSET, sizeof(IndexStats));
+    memcpy(&includedSize, buffer + META_LAYOUT_OFFSET, sizeof(int));
+    memcpy(&overflowPid, buffer + META_LAYOUT_OFFSET + sizeof(int), sizeof(PageId));
+    memcpy(&bloomBlocks, buffer + META_LAYOUT_OFFSET + sizeof(int) + sizeof(PageId), sizeof(int));
+  }
+
+  // the filter is only opened for lookups. a missing sidecar is not an
+  // error; every key is then treated as possibly present.
+  if (bloomBlocks > 0 && bloom.open(bloomName, 'r', bloomBlocks) != 0) {
+    bloomBlocks = 0;
+  }
+
   return 0;
 }
 
@@ -68,10 +147,41 @@ RC BTreeIndex::close()
 {
   RC rc;
 
-  memcpy(buffer, &rootPid, sizeof(PageId));
-  memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
+  if (bloomBlocks > 0) {
+    bloom.close();
+  }
+
+  // the meta page only changes when something was inserted.
+  // the histogram and the Bloom filter are rebuilt from the sorted keys.
+  if (statsDirty) {
+    vector<int> keys;
+    int leaves;
+    rc = collectKeys(keys, leaves);
+    if (rc == 0) {
+      rebuildStats(keys, leaves);
+      statsValid = true;
+      statsDirty = false;
+
+      BloomFilter filter;
+      bloomBlocks = 0;
+      if (filter.open(bloomName, 'w', 0) == 0) {
+        if (filter.build(keys) == 0) {
+          bloomBlocks = filter.getBlockCount();
+        }
+        filter.close();
+      }
+    }
+
+    memcpy(buffer, &rootPid, sizeof(PageId));
+    memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
+    memcpy(buffer + META_MAGIC_OFFSET, &META_MAGIC, sizeof(int));
+    memcpy(buffer + META_STATS_OFFSET, &stats, sizeof(IndexStats));
+    memcpy(buffer + META_LAYOUT_OFFSET, &includedSize, sizeof(int));
+    memcpy(buffer + META_LAYOUT_OFFSET + sizeof(int), &overflowPid, sizeof(PageId));
+    memcpy(buffer + META_LAYOUT_OFFSET + sizeof(int) + sizeof(PageId), &bloomBlocks, sizeof(int));
 
-  rc = pf.write(0, buffer); // Write rootPid/treeHeight to disk
+    rc = pf.write(0, buffer); // Write rootPid/treeHeight/stats to disk
+  }
 
   rc = pf.close();
   if (rc != 0) {
@@ -88,50 +198,117 @@ RC BTreeIndex::close()
  * @return error code. 0 if no error
  */
 RC BTreeIndex::insert(int key, const RecordId& rid)
+{
+  return insert(key, rid, string());
+}
+
+/*
+ * Turn an empty index into a covering index.
+ */
+RC BTreeIndex::setCovering(int size)
+{
+  // the entry must at least hold the length and an overflow reference,
+  // and a leaf must still hold a few entries
+  if (treeHeight != 0 || size < (int) (sizeof(short) + sizeof(PageId) + sizeof(int)) ||
+      size > PageFile::PAGE_SIZE / 4) {
+    return RC_INVALID_ATTRIBUTE;
+  }
+
+  includedSize = size;
+  statsDirty = true;
+  return 0;
+}
+
+/*
+ * Insert (key, RecordId) pair and the value of a covering index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @param value[IN] the record value. ignored unless the index is covering
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::insert(int key, const RecordId& rid, const string& value)
 {
   RC rc;
   // Empty tree, insert first element
-  BTLeafNode leaf_node;
+  BTLeafNode leaf_node(includedSize);
+
+  // the included value bytes of a covering index
+  char included[PageFile::PAGE_SIZE];
+  if (includedSize > 0 && (rc = encodeValue(value, included)) != 0) {
+    return rc;
+  }
+
+  // a key at or beyond the current maximum belongs at the end of the
+  // rightmost leaf. as long as that leaf has room, skip the descent.
+  bool appending = statsValid && stats.rowCount > 0 && key >= stats.maxKey;
+
+  // keep the cheap statistics current; the histogram and the exact
+  // distinct count are rebuilt from the leaves when the index is closed
+  if (stats.rowCount == 0 || key < stats.minKey) stats.minKey = key;
+  if (stats.rowCount == 0 || key > stats.maxKey) stats.maxKey = key;
+  stats.rowCount++;
+  stats.distinctKeys++;
+  statsDirty = true;
 
   if (treeHeight == 0) {
-    rc = leaf_node.insert(key, rid);
+    rc = leaf_node.insert(key, rid, included);
     treeHeight++;
-    rootPid = 1; // pid 0 is saved for index stf
+    rootPid = (pf.endPid() > 1) ? pf.endPid() : 1; // pid 0 is saved for index stf
+    rightmostPid = rootPid;
 
     rc = leaf_node.write(rootPid, pf); // write before done
     return rc;
   }
 
+  if (appending) {
+    if (rightmostPid < 0) {
+      rightmostPid = rightmostLeaf();
+    }
+    if (rightmostPid > 0 && leaf_node.read(rightmostPid, pf) == 0 &&
+        leaf_node.insert(key, rid, included) == 0) {
+      return leaf_node.write(rightmostPid, pf);
+    }
+    // the rightmost leaf is full. the split has to update its parent,
+    // so take the regular path from the root.
+  }
+
   // IndexCursor cursor;
   // rc = locate(key, cursor);
   // // cursor is now at entry immediately after largest key smaller than searchKey
 
   PageId movePid = -1;
   int moveKey = -1;
-  rc = insertHelper(key, rid, rootPid, 1, movePid, moveKey); // start at root (height == 1)
+  rc = insertHelper(key, rid, included, rootPid, 1, true, movePid, moveKey); // start at root (height == 1)
 
   return 0;
 }
 
-RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId curPid, int curHeight, PageId& movePid, int& moveKey) {
+RC BTreeIndex::insertHelper(int key, const RecordId& rid, const char* included, PageId curPid, int curHeight, bool rightmost, PageId& movePid, int& moveKey) {
   RC rc;
     movePid = -1;
     moveKey = -1;
   if (curHeight == treeHeight) { // Base case: inserting leaf node
-    BTLeafNode leaf_node;
+    BTLeafNode leaf_node(includedSize);
     rc = leaf_node.read(curPid, pf);
     if (rc != 0) {
       return rc;
     }
-    rc = leaf_node.insert(key, rid);
+    rc = leaf_node.insert(key, rid, included);
     if (rc == 0) { // If successfully insert, write and return (no overflow)
       rc = leaf_node.write(curPid, pf);
       return rc;
     }
-    // Not successfully insert. Overflow => try insertAndSplit
-    BTLeafNode siblingLeaf;
+    // Not successfully insert. Overflow => try insertAndSplit.
+    // Appending to the rightmost leaf leaves the left node nearly full,
+    // since nothing will be inserted into it in an ascending load.
+    int lastKey;
+    RecordId lastRid;
+    leaf_node.readEntry(leaf_node.getKeyCount() - 1, lastKey, lastRid);
+    int splitPercent = (rightmost && key >= lastKey) ? appendSplitPercent : 50;
+
+    BTLeafNode siblingLeaf(includedSize);
     int siblingKey;
-    rc = leaf_node.insertAndSplit(key, rid, siblingLeaf, siblingKey); // returns siblingKey, which we need to push to parent
+    rc = leaf_node.insertAndSplit(key, rid, siblingLeaf, siblingKey, splitPercent, included); // returns siblingKey, which we need to push to parent
 
     if (rc != 0) {
       return rc;
@@ -144,6 +321,9 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId curPid, int cur
     // set sibling next ptr
     siblingLeaf.setNextNodePtr(leaf_node.getNextNodePtr()); //TODO properly set this when we dont split the last node
     leaf_node.setNextNodePtr(endPid);
+    if (rightmost) {
+      rightmostPid = endPid;
+    }
 
     // write to disk
     rc = leaf_node.write(curPid, pf);
@@ -158,10 +338,10 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId curPid, int cur
     // at height of 1, insertAndSplit needs to create a new root to push up to
     if (treeHeight == 1) {
       BTNonLeafNode root;
-        int root_key;
-        RecordId root_rid;
-        leaf_node.readEntry(0, root_key, root_rid); // ***
-      rc = root.initializeRoot(curPid, root_key, endPid, siblingKey);
+      // the first child takes every key below siblingKey, including keys
+      // smaller than any inserted so far. a real key here would let a later
+      // split insert its separator in front of the first child.
+      rc = root.initializeRoot(curPid, INT_MIN, endPid, siblingKey);
       treeHeight++;
       rootPid = pf.endPid(); // Write new root to the next empty spot in pf
       rc = root.write(rootPid, pf);
@@ -176,23 +356,35 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId curPid, int cur
     PageId childPid = -1;
     rc = node.locateChildPtr(key, childPid); // returns childPid TODO: something now working here
 
+    // the child is on the rightmost path if this node is and the child
+    // is its last one
+    int lastKey;
+    PageId lastPid;
+    node.readNonLeafEntry(node.getKeyCount() - 1, lastKey, lastPid);
+    bool childRightmost = rightmost && childPid == lastPid;
+
     int mPid = -1;
     int mKey = -1;
-    rc = insertHelper(key, rid, childPid, curHeight+1, mPid, mKey); // Recursively traverse down the tree, following the ptrs
+    rc = insertHelper(key, rid, included, childPid, curHeight+1, childRightmost, mPid, mKey); // Recursively traverse down the tree, following the ptrs
 
     // Once movePid & moveKey modified, (base case reached), can push them up to parent
-    if (mPid != -1 && mKey != -1) {
-      // Parent = our current node right now. Insert into cur.
-      rc = node.insert(mKey, mPid);
+    if (mPid != -1) {
+      // Parent = our current node right now. Insert into cur, right
+      // after the child that split: mKey may equal the keys around it.
+      rc = node.insert(mKey, mPid, childPid);
 
       if (rc == 0) { // successfully insert, write & return
         rc = node.write(curPid, pf);
         return rc;
       }
-      // Not successful, try insertAndSplit
+      // Not successful, try insertAndSplit. A split of the last child on
+      // the rightmost path means keys are arriving in ascending order;
+      // anywhere else the node keeps filling on both sides.
+      int splitPercent = childRightmost ? appendSplitPercent : 50;
+
       BTNonLeafNode siblingNode;
       int siblingKey;
-      rc = node.insertAndSplit(mKey, mPid, siblingNode, siblingKey);
+      rc = node.insertAndSplit(mKey, mPid, siblingNode, siblingKey, splitPercent, childPid);
 
       if (rc != 0) {
         return rc; // error
@@ -215,10 +407,7 @@ RC BTreeIndex::insertHelper(int key, const RecordId& rid, PageId curPid, int cur
       // If push all the way to height == 1, need to make a new root again
       if (curHeight == 1) {
         BTNonLeafNode root;
-          int root_key;
-          PageId root_pid;
-          node.readNonLeafEntry(0, root_key, root_pid); // ***
-          rc = root.initializeRoot(curPid, root_key, endPid, siblingKey);
+        rc = root.initializeRoot(curPid, INT_MIN, endPid, siblingKey);
         treeHeight++;
         rootPid = pf.endPid(); // Write new root to the next empty spot in pf
         rc = root.write(rootPid, pf);
@@ -250,7 +439,7 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 {
   RC rc;
   BTNonLeafNode node;
-  BTLeafNode leaf_node;
+  BTLeafNode leaf_node(includedSize);
 
   PageId pid = rootPid;
   int eid;
@@ -261,8 +450,10 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
       return rc;
     }
 
-    rc = node.locateChildPtr(searchKey, pid);
-    if (rc != 0 && rc != RC_NO_SUCH_RECORD) {
+    // a key equal to a separator may also end the child left of it.
+    // readForward() moves on to the next leaf if it does not.
+    rc = node.locateFirstChildPtr(searchKey, pid);
+    if (rc != 0) {
       return rc;
     }
   }
@@ -280,6 +471,77 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
   return rc;
 }
 
+/*
+ * Descend like locate(), but to the rightmost child whose first key is not
+ * greater than searchKey, remembering the child left of it on the deepest
+ * level where there is one: its rightmost leaf is the leaf before the one
+ * reached, and all of its keys are small enough.
+ */
+RC BTreeIndex::locateLast(int searchKey, int& key)
+{
+  RC rc;
+  BTNonLeafNode node;
+  BTLeafNode leaf_node(includedSize);
+  RecordId rid;
+
+  PageId pid = rootPid;
+  PageId left = -1;      // the subtree holding the leaf before pid
+  int leftHeight = 0;    // the level of left
+  int entryKey;
+  PageId child;
+
+  if (treeHeight == 0) {
+    return RC_NO_SUCH_RECORD;
+  }
+
+  for (int height = 1; height < treeHeight; height++) {
+    if ((rc = node.read(pid, pf)) != 0) {
+      return rc;
+    }
+
+    int n = node.getKeyCount();
+    int eid = 0;
+    while (eid + 1 < n) {
+      node.readNonLeafEntry(eid + 1, entryKey, child);
+      if (entryKey > searchKey) break;
+      eid++;
+    }
+    if (eid > 0) {
+      node.readNonLeafEntry(eid - 1, entryKey, left);
+      leftHeight = height + 1;
+    }
+    node.readNonLeafEntry(eid, entryKey, pid);
+  }
+
+  if ((rc = leaf_node.read(pid, pf)) != 0) {
+    return rc;
+  }
+  for (int eid = leaf_node.getKeyCount() - 1; eid >= 0; eid--) {
+    leaf_node.readEntry(eid, key, rid);
+    if (key <= searchKey) {
+      return 0;
+    }
+  }
+
+  // all keys of the leaf are too large: take the last key of the leaf before it
+  if (left < 0) {
+    return RC_NO_SUCH_RECORD;
+  }
+  for (int height = leftHeight; height < treeHeight; height++) {
+    if ((rc = node.read(left, pf)) != 0) {
+      return rc;
+    }
+    node.readNonLeafEntry(node.getKeyCount() - 1, entryKey, left);
+  }
+  if ((rc = leaf_node.read(left, pf)) != 0) {
+    return rc;
+  }
+  if (leaf_node.getKeyCount() == 0) {
+    return RC_NO_SUCH_RECORD;
+  }
+  return leaf_node.readEntry(leaf_node.getKeyCount() - 1, key, rid);
+}
+
 /*
  * Read the (key, rid) pair at the location specified by the index cursor,
  * and move foward the cursor to the next entry.
@@ -291,21 +553,75 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
 {
   RC rc;
-  PageId pid = cursor.pid;
-  int eid = cursor.eid;
+  int eid;
+
+  BTLeafNode node(includedSize);
+  rc = readCursor(cursor, node, eid);
+  if (rc != 0) {
+    return rc;
+  }
+
+  return node.readEntry(eid, key, rid);
+}
+
+/*
+ * Read the (key, rid) pair and the included value at the location
+ * specified by the index cursor, and move foward the cursor to the next entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @param value[OUT] the record value stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid, string& value)
+{
+  RC rc;
+  int eid;
 
-  BTLeafNode node;
-  rc = node.read(pid, pf);
+  if (includedSize == 0) {
+    return RC_INVALID_ATTRIBUTE;
+  }
+
+  BTLeafNode node(includedSize);
+  rc = readCursor(cursor, node, eid);
   if (rc != 0) {
     return rc;
   }
 
-  rc = node.readEntry(eid, key, rid);
+  node.readEntry(eid, key, rid);
+  return decodeValue(node.readIncluded(eid), value);
+}
+
+RC BTreeIndex::readCursor(IndexCursor& cursor, BTLeafNode& node, int& eid)
+{
+  RC rc;
+
+  if (cursor.pid <= 0) {
+    return RC_END_OF_TREE;
+  }
+
+  rc = node.read(cursor.pid, pf);
   if (rc != 0) {
     return rc;
   }
 
-  // If eid > numKeys, overflow. Find next node to move the cursor
+  // locate() leaves the cursor behind the last entry of a leaf when every
+  // key in the leaf is smaller than the search key
+  while (cursor.eid >= node.getKeyCount()) {
+    cursor.pid = node.getNextNodePtr();
+    cursor.eid = 0;
+    if (cursor.pid <= 0) {
+      return RC_END_OF_TREE;
+    }
+    rc = node.read(cursor.pid, pf);
+    if (rc != 0) {
+      return rc;
+    }
+  }
+  eid = cursor.eid;
+
+  // If eid is the last entry, move the cursor to the next node.
+  // At the end of the tree the cursor pid becomes -1.
   if (eid >= node.getKeyCount() - 1) {
     cursor.pid = node.getNextNodePtr();
     cursor.eid = 0;
@@ -314,13 +630,661 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
     cursor.eid++;
   }
 
-  if (cursor.pid == -1) {
-    return RC_INVALID_CURSOR; // End of index
+  return 0;
+}
+
+BTreeIndex::LeafScanner::LeafScanner(BTreeIndex& index)
+  : index(index), leaf(index.includedSize)
+{
+  count = 0;
+  cursor.pid = -1;
+  cursor.eid = 0;
+}
+
+/*
+ * descend like BTreeIndex::locate(), reading the nodes around the cache.
+ */
+RC BTreeIndex::LeafScanner::locate(int searchKey)
+{
+  RC rc;
+  BTNonLeafNode node;
+  PageId pid = index.rootPid;
+
+  // an empty index has no root, and readForward() finds no entries
+  cursor.pid = -1;
+  if (index.treeHeight == 0) {
+    return 0;
+  }
+
+  for (int height = 1; height < index.treeHeight; height++) {
+    if ((rc = node.readDirect(pid, index.pf)) != 0) {
+      return rc;
+    }
+    if ((rc = node.locateFirstChildPtr(searchKey, pid)) != 0) {
+      return rc;
+    }
   }
 
+  if ((rc = leaf.readDirect(pid, index.pf)) != 0) {
+    return rc;
+  }
+  count = leaf.getKeyCount();
+  cursor.pid = pid;
+  leaf.locate(searchKey, cursor.eid);
+
   return 0;
 }
 
+/*
+ * load the leaf of the next entry if the position is behind the last
+ * entry of the loaded one.
+ */
+RC BTreeIndex::LeafScanner::nextEntry()
+{
+  RC rc;
+
+  if (cursor.pid <= 0) {
+    return RC_END_OF_TREE;
+  }
+  while (cursor.eid >= count) {
+    cursor.pid = leaf.getNextNodePtr();
+    cursor.eid = 0;
+    if (cursor.pid <= 0) {
+      return RC_END_OF_TREE;
+    }
+    if ((rc = leaf.readDirect(cursor.pid, index.pf)) != 0) {
+      return rc;
+    }
+    count = leaf.getKeyCount();
+  }
+
+  return 0;
+}
+
+RC BTreeIndex::LeafScanner::readForward(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if ((rc = nextEntry()) != 0) {
+    return rc;
+  }
+  return leaf.readEntry(cursor.eid++, key, rid);
+}
+
+RC BTreeIndex::LeafScanner::readForward(int& key, RecordId& rid, string& value)
+{
+  RC rc;
+
+  if (index.includedSize == 0) {
+    return RC_INVALID_ATTRIBUTE;
+  }
+  if ((rc = nextEntry()) != 0) {
+    return rc;
+  }
+
+  leaf.readEntry(cursor.eid, key, rid);
+  return index.decodeValue(leaf.readIncluded(cursor.eid++), value);
+}
+
+RC BTreeIndex::encodeValue(const string& value, char* included)
+{
+  RC rc;
+  char page[PageFile::PAGE_SIZE];
+  int size = value.size();
+  short length = (size > SHRT_MAX) ? LONG_VALUE : size;
+
+  // the bytes after the value are written to the leaf as well, so they
+  // are zeroed rather than left with whatever the buffer held
+  memset(included, 0, includedSize);
+  memcpy(included, &length, sizeof(short));
+  if (length >= 0 && length <= includedSize - (int) sizeof(short)) {
+    memcpy(included + sizeof(short), value.data(), length);
+    return 0;
+  }
+
+  // the bytes that go to the overflow pages: the value, after its length
+  // if the length does not fit in a short
+  string prefix;
+  if (length == LONG_VALUE) {
+    prefix.assign((const char*) &size, sizeof(int));
+  }
+  const string* parts[2] = { &prefix, &value };
+
+  // append the value to the last overflow page
+  PageId next = -1;
+  int used = OVERFLOW_CAPACITY;
+  if (overflowPid > 0) {
+    if ((rc = pf.read(overflowPid, page)) != 0) {
+      return rc;
+    }
+    memcpy(&used, page + sizeof(PageId), sizeof(int));
+  }
+
+  bool referenced = false;
+  for (int p = 0; p < 2; p++) {
+    const string& bytes = *parts[p];
+    int written = 0;
+    while (written < (int) bytes.size()) {
+      // start a new overflow page when there is none yet or the last one is
+      // full. a full page is written out once it is linked to the new one.
+      // the last page may not be written yet, so the new one is allocated
+      // after it rather than at endPid().
+      if (used == OVERFLOW_CAPACITY) {
+        next = (pf.endPid() > 1) ? pf.endPid() : 1; // pid 0 is the meta page
+        if (overflowPid > 0) {
+          if (next <= overflowPid) {
+            next = overflowPid + 1;
+          }
+          memcpy(page, &next, sizeof(PageId));
+          if ((rc = pf.write(overflowPid, page)) != 0) {
+            return rc;
+          }
+        }
+        overflowPid = next;
+        used = 0;
+        next = -1;
+        memset(page, 0, PageFile::PAGE_SIZE);
+        memcpy(page, &next, sizeof(PageId));
+      }
+
+      if (!referenced) {
+        memcpy(included + sizeof(short), &overflowPid, sizeof(PageId));
+        memcpy(included + sizeof(short) + sizeof(PageId), &used, sizeof(int));
+        referenced = true;
+      }
+
+      int n = OVERFLOW_CAPACITY - used;
+      if (n > (int) bytes.size() - written) {
+        n = bytes.size() - written;
+      }
+      memcpy(page + OVERFLOW_HEADER + used, bytes.data() + written, n);
+      used += n;
+      written += n;
+      memcpy(page + sizeof(PageId), &used, sizeof(int));
+    }
+  }
+
+  statsDirty = true;
+  return pf.write(overflowPid, page);
+}
+
+RC BTreeIndex::readOverflow(PageId& pid, int& offset, int length, string& bytes)
+{
+  RC rc;
+  char page[PageFile::PAGE_SIZE];
+
+  // follow the overflow pages until length bytes are read. every page but
+  // the last is full, so the next byte after a full page is on the next one.
+  bytes.erase();
+  while ((int) bytes.size() < length) {
+    if ((rc = pf.read(pid, page)) != 0) {
+      return rc;
+    }
+    int n = OVERFLOW_CAPACITY - offset;
+    if (n > length - (int) bytes.size()) {
+      n = length - bytes.size();
+    }
+    bytes.append(page + OVERFLOW_HEADER + offset, n);
+    offset += n;
+    if (offset == OVERFLOW_CAPACITY) {
+      memcpy(&pid, page, sizeof(PageId));
+      offset = 0;
+    }
+  }
+
+  return 0;
+}
+
+RC BTreeIndex::decodeValue(const char* included, string& value)
+{
+  RC rc;
+  short length;
+
+  memcpy(&length, included, sizeof(short));
+  if (length >= 0 && length <= includedSize - (int) sizeof(short)) {
+    value.assign(included + sizeof(short), length);
+    return 0;
+  }
+
+  PageId pid;
+  int offset;
+  memcpy(&pid, included + sizeof(short), sizeof(PageId));
+  memcpy(&offset, included + sizeof(short) + sizeof(PageId), sizeof(int));
+
+  int size = length;
+  if (length == LONG_VALUE) {
+    if ((rc = readOverflow(pid, offset, sizeof(int), value)) != 0) {
+      return rc;
+    }
+    memcpy(&size, value.data(), sizeof(int));
+  }
+  return readOverflow(pid, offset, size, value);
+}
+
+/*
+ * Estimate the # entries with key <= searchKey by interpolating linearly
+ * inside the histogram bucket that contains searchKey.
+ */
+double BTreeIndex::countAtMost(int searchKey) const
+{
+  if (stats.rowCount == 0 || searchKey < stats.minKey) {
+    return 0;
+  }
+  if (searchKey >= stats.maxKey || stats.bucketCount == 0) {
+    return stats.rowCount;
+  }
+
+  int i = 0;
+  while (i < stats.bucketCount - 1 && stats.bucketHigh[i] < searchKey) {
+    i++;
+  }
+  if (stats.bucketHigh[i] == searchKey) {
+    return stats.bucketRows[i];
+  }
+
+  double prevHigh = (i > 0) ? stats.bucketHigh[i-1] : (double) stats.minKey - 1;
+  double prevRows = (i > 0) ? stats.bucketRows[i-1] : 0;
+  double high = stats.bucketHigh[i];
+
+  return prevRows + (stats.bucketRows[i] - prevRows) * (searchKey - prevHigh) / (high - prevHigh);
+}
+
+int BTreeIndex::estimateRows(int low, int high) const
+{
+  if (low > high || stats.rowCount == 0) {
+    return 0;
+  }
+
+  double below = (low <= stats.minKey) ? 0 : countAtMost(low - 1);
+  double rows = countAtMost(high) - below;
+  if (rows <= 0) {
+    return 0;
+  }
+
+  // a non-empty range that overlaps the keys matches at least one entry
+  // on average; never round a small estimate down to zero
+  int n = (int) rows;
+  return (rows > n) ? n + 1 : n;
+}
+
+double BTreeIndex::selectivity(int low, int high) const
+{
+  if (stats.rowCount == 0) {
+    return 0.0;
+  }
+  return (double) estimateRows(low, high) / stats.rowCount;
+}
+
+int BTreeIndex::estimateScanPages(int low, int high, bool fetchRecords) const
+{
+  int rows = estimateRows(low, high);
+  int perLeaf = MAX_NODE_SIZE;
+  if (stats.leafCount > 0 && stats.rowCount >= stats.leafCount) {
+    perLeaf = stats.rowCount / stats.leafCount;
+  }
+
+  // one root-to-leaf descent, then the leaf chain covering the range
+  int pages = (treeHeight > 1) ? treeHeight - 1 : 0;
+  pages += (rows + perLeaf - 1) / perLeaf;
+  if (pages == 0 && treeHeight > 0) {
+    pages = 1;
+  }
+
+  // every match is a random access to the table
+  if (fetchRecords) {
+    pages += rows;
+  }
+
+  return pages;
+}
+
+RC BTreeIndex::splitRange(int low, int high, int parts, vector<int>& starts)
+{
+  RC rc;
+  BTNonLeafNode node;
+  vector<PageId> level(1, rootPid);  // the nodes of a level that overlap the range
+  vector<int> separators;
+
+  starts.assign(1, low);
+  if (low >= high || parts < 2) {
+    return 0;
+  }
+
+  // child i of a non-leaf node holds the keys from its key up to the key of
+  // child i+1, so the keys of the children after the first separate them
+  for (int height = 1; height < treeHeight; height++) {
+    vector<PageId> children;
+
+    for (unsigned n = 0; n < level.size(); n++) {
+      if ((rc = node.read(level[n], pf)) != 0) {
+        return rc;
+      }
+
+      int count = node.getKeyCount();
+      for (int i = 0; i < count; i++) {
+        int key, nextKey;
+        PageId pid, nextPid;
+        node.readNonLeafEntry(i, key, pid);
+        if (i > 0 && key > high) {
+          break;
+        }
+        if (i + 1 < count) {
+          node.readNonLeafEntry(i + 1, nextKey, nextPid);
+          if (nextKey <= low) {
+            continue;
+          }
+        }
+        if (i > 0 && key >= low && key < high) {
+          separators.push_back(key);
+        }
+        children.push_back(pid);
+      }
+    }
+
+    if ((int) separators.size() + 1 >= parts) {
+      break;
+    }
+    level.swap(children);
+  }
+
+  // use parts - 1 of the separators, spread evenly. a sub-range starts
+  // after a separator key: with duplicate keys, some entries with the
+  // separator key can be in the child to its left, and only a cursor
+  // coming from the left reads them all
+  sort(separators.begin(), separators.end());
+  separators.erase(unique(separators.begin(), separators.end()), separators.end());
+  int k = separators.size();
+  for (int j = 1; j < parts && j <= k; j++) {
+    int i = (k >= parts) ? (int) ((long) j * k / parts) : j - 1;
+    starts.push_back(separators[i] + 1);
+  }
+
+  return 0;
+}
+
+/*
+ * Follow the first child pointer from the root down to the leaf level.
+ */
+PageId BTreeIndex::leftmostLeaf()
+{
+  BTNonLeafNode node;
+  PageId pid = rootPid;
+  int key;
+
+  for (int height = 1; height < treeHeight; height++) {
+    if (node.read(pid, pf) != 0) {
+      return -1;
+    }
+    node.readNonLeafEntry(0, key, pid);
+  }
+
+  return pid;
+}
+
+/*
+ * Follow the last child pointer from the root down to the leaf level.
+ */
+PageId BTreeIndex::rightmostLeaf()
+{
+  BTNonLeafNode node;
+  PageId pid = rootPid;
+  int key;
+
+  for (int height = 1; height < treeHeight; height++) {
+    if (node.read(pid, pf) != 0) {
+      return -1;
+    }
+    node.readNonLeafEntry(node.getKeyCount() - 1, key, pid);
+  }
+
+  return pid;
+}
+
+bool BTreeIndex::mayContain(int searchKey) const
+{
+  // keys inserted since the filter was built are not in it
+  if (bloomBlocks == 0 || statsDirty) {
+    return true;
+  }
+  return bloom.mayContain(searchKey);
+}
+
+/*
+ * Walk the leaf chain once, in key order, and collect the keys.
+ */
+RC BTreeIndex::collectKeys(vector<int>& keys, int& leaves)
+{
+  RC rc;
+  leaves = 0;
+
+  if (treeHeight > 0) {
+    BTLeafNode leaf(includedSize);
+    int key;
+    RecordId rid;
+
+    for (PageId pid = leftmostLeaf(); pid > 0; pid = leaf.getNextNodePtr()) {
+      if ((rc = leaf.read(pid, pf)) != 0) {
+        return rc;
+      }
+      leaves++;
+
+      int n = leaf.getKeyCount();
+      for (int eid = 0; eid < n; eid++) {
+        leaf.readEntry(eid, key, rid);
+        keys.push_back(key);
+      }
+    }
+  }
+
+  return 0;
+}
+
+/*
+ * Walk the leaf chain once, in key order, and collect the entries.
+ */
+RC BTreeIndex::collectEntries(vector<IndexEntry>& entries)
+{
+  RC rc;
+  IndexCursor cursor;
+  IndexEntry entry;
+
+  if (treeHeight == 0) {
+    return 0;
+  }
+
+  cursor.pid = leftmostLeaf();
+  cursor.eid = 0;
+  while (true) {
+    if (includedSize > 0) {
+      rc = readForward(cursor, entry.key, entry.rid, entry.value);
+    } else {
+      rc = readForward(cursor, entry.key, entry.rid);
+    }
+    if (rc == RC_END_OF_TREE) {
+      return 0;
+    }
+    if (rc != 0) {
+      return rc;
+    }
+    entries.push_back(entry);
+  }
+}
+
+RC BTreeIndex::bulkLoad(const vector<IndexEntry>& entries, int fillPercent)
+{
+  RC rc;
+  int n = entries.size();
+
+  if (treeHeight != 0) {
+    return RC_INVALID_ATTRIBUTE;
+  }
+  if (n == 0) {
+    return 0;
+  }
+
+  // spill long values of a covering index first, so that the overflow
+  // pages do not end up between the leaves
+  vector<char> included(n * includedSize);
+  for (int i = 0; i < n && includedSize > 0; i++) {
+    if ((rc = encodeValue(entries[i].value, &included[i * includedSize])) != 0) {
+      return rc;
+    }
+  }
+
+  // fill the leaves left to right. leaf i goes to page firstPid + i,
+  // so the leaf chain is one contiguous run of pages in key order.
+  BTLeafNode probe(includedSize);
+  int perLeaf = probe.getMaxKeyCount() * fillPercent / 100;
+  if (perLeaf < 1) perLeaf = 1;
+  int leafCount = (n + perLeaf - 1) / perLeaf;
+  PageId firstPid = (pf.endPid() > 1) ? pf.endPid() : 1; // pid 0 is the meta page
+
+  // (first key, pid) of every node on the level being built
+  vector<int> levelKeys;
+  vector<PageId> levelPids;
+
+  for (int i = 0; i < leafCount; i++) {
+    BTLeafNode leaf(includedSize);
+    for (int j = i * perLeaf; j < n && j < (i + 1) * perLeaf; j++) {
+      if ((rc = leaf.insert(entries[j].key, entries[j].rid,
+                            includedSize > 0 ? &included[j * includedSize] : NULL)) != 0) {
+        return rc;
+      }
+    }
+    leaf.setNextNodePtr(i < leafCount - 1 ? firstPid + i + 1 : -1);
+    if ((rc = leaf.write(firstPid + i, pf)) != 0) {
+      return rc;
+    }
+    levelKeys.push_back(entries[i * perLeaf].key);
+    levelPids.push_back(firstPid + i);
+  }
+  treeHeight = 1;
+  rightmostPid = firstPid + leafCount - 1;
+
+  // build the non-leaf levels on top until a single node is left
+  int perNode = MAX_NODE_SIZE * fillPercent / 100;
+  if (perNode < 2) perNode = 2;
+
+  while (levelPids.size() > 1) {
+    vector<int> upperKeys;
+    vector<PageId> upperPids;
+
+    for (unsigned i = 0; i < levelPids.size(); i += perNode) {
+      BTNonLeafNode node;
+      for (unsigned j = i; j < levelPids.size() && j < i + perNode; j++) {
+        // the first child of the leftmost node takes every smaller key
+        int key = (j == 0) ? INT_MIN : levelKeys[j];
+        if ((rc = node.insert(key, levelPids[j])) != 0) {
+          return rc;
+        }
+      }
+      PageId pid = pf.endPid();
+      if ((rc = node.write(pid, pf)) != 0) {
+        return rc;
+      }
+      upperKeys.push_back(levelKeys[i]);
+      upperPids.push_back(pid);
+    }
+
+    levelKeys.swap(upperKeys);
+    levelPids.swap(upperPids);
+    treeHeight++;
+  }
+  rootPid = levelPids[0];
+
+  // the statistics and the Bloom filter are rebuilt when the index is closed
+  statsDirty = true;
+  return 0;
+}
+
+RC BTreeIndex::rebuild(int fillPercent, int& pagesBefore, int& pagesAfter)
+{
+  RC rc;
+  vector<IndexEntry> entries;
+
+  if (openMode != 'w' && openMode != 'W') {
+    return RC_INVALID_FILE_MODE;
+  }
+  if ((rc = collectEntries(entries)) != 0) {
+    return rc;
+  }
+  pagesBefore = pf.endPid();
+
+  // build the compacted tree next to the current one
+  string newName = indexName + ".new";
+  string newBloomName = sidecarName(newName);
+  ::unlink(newName.c_str());
+  ::unlink(newBloomName.c_str());
+
+  BTreeIndex compacted;
+  if ((rc = compacted.open(newName, 'w')) != 0) {
+    return rc;
+  }
+  if (includedSize > 0) {
+    compacted.setCovering(includedSize);
+  }
+  rc = compacted.bulkLoad(entries, fillPercent);
+  pagesAfter = compacted.pf.endPid();
+  compacted.close();
+  if (rc != 0) {
+    ::unlink(newName.c_str());
+    ::unlink(newBloomName.c_str());
+    return rc;
+  }
+
+  // swap it in. rename() replaces the index file atomically. the key set
+  // did not change, so the new Bloom filter is identical to the old one
+  // and the order of the two renames does not matter to readers.
+  close();
+  if (::rename(newName.c_str(), indexName.c_str()) < 0) {
+    ::unlink(newName.c_str());
+    ::unlink(newBloomName.c_str());
+    open(indexName, 'w');
+    return RC_FILE_WRITE_FAILED;
+  }
+  ::rename(newBloomName.c_str(), bloomName.c_str());
+
+  // forget the old tree before reading the meta page of the new one
+  rootPid = -1;
+  treeHeight = 0;
+  return open(indexName, 'w');
+}
+
+/*
+ * The keys come out of the leaves sorted, so the equi-depth bucket
+ * boundaries are exact.
+ */
+void BTreeIndex::rebuildStats(const vector<int>& keys, int leaves)
+{
+  memset(&stats, 0, sizeof(IndexStats));
+  stats.rowCount = keys.size();
+  stats.leafCount = leaves;
+  if (keys.empty()) {
+    return;
+  }
+
+  stats.minKey = keys.front();
+  stats.maxKey = keys.back();
+  stats.distinctKeys = 1;
+  for (unsigned i = 1; i < keys.size(); i++) {
+    if (keys[i] != keys[i-1]) stats.distinctKeys++;
+  }
+
+  // equi-depth buckets: every bucket ends at the (i+1)/B quantile.
+  // duplicates of a boundary key all go into the bucket it ends.
+  long n = keys.size();
+  int buckets = (n < HISTOGRAM_BUCKETS) ? n : HISTOGRAM_BUCKETS;
+  for (int i = 0; i < buckets; i++) {
+    int high = keys[(i + 1) * n / buckets - 1];
+    if (stats.bucketCount > 0 && stats.bucketHigh[stats.bucketCount - 1] == high) {
+      continue;
+    }
+    stats.bucketHigh[stats.bucketCount] = high;
+    stats.bucketRows[stats.bucketCount] = upper_bound(keys.begin(), keys.end(), high) - keys.begin();
+    stats.bucketCount++;
+  }
+}
+
 // TODO: add these functions to your BTreeIndex.cc file for testing for the print function
 int BTreeIndex::getTreeHeight(void) { return treeHeight; }
 PageId BTreeIndex::getRootPid(void) { return rootPid; }
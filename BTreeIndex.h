@@ -13,6 +13,9 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeNode.h"
+#include "BloomFilter.h"
+#include <vector>
 
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
@@ -27,6 +30,35 @@ typedef struct {
   int     eid;
 } IndexCursor;
 
+/**
+ * A (key, rid) pair of the index, with the record value of a covering
+ * index. Used to load an index from sorted entries in one pass.
+ */
+typedef struct {
+  int         key;
+  RecordId    rid;
+  std::string value;
+} IndexEntry;
+
+/**
+ * Key statistics of an index, persisted in its meta page (page 0) right
+ * after rootPid and treeHeight. The histogram is equi-depth: bucket i
+ * covers the keys in (bucketHigh[i-1], bucketHigh[i]] and bucketRows[i]
+ * is the cumulative # entries with key <= bucketHigh[i].
+ */
+const int HISTOGRAM_BUCKETS = 64;
+
+typedef struct {
+  int rowCount;      // # (key, rid) entries in the index
+  int distinctKeys;  // estimated # distinct keys
+  int minKey;        // smallest key (valid only if rowCount > 0)
+  int maxKey;        // largest key (valid only if rowCount > 0)
+  int leafCount;     // # leaf nodes in the tree
+  int bucketCount;   // # histogram buckets in use
+  int bucketHigh[HISTOGRAM_BUCKETS];
+  int bucketRows[HISTOGRAM_BUCKETS];
+} IndexStats;
+
 /**
  * Implements a B-Tree index for bruinbase.
  *
@@ -50,6 +82,27 @@ class BTreeIndex {
    */
   RC close();
 
+  /**
+   * Make the index a covering index that stores the value of every record
+   * in the leaf next to its RecordId. The first includedSize - 2 bytes of a
+   * value are kept in the leaf; longer values go to overflow pages.
+   * Must be called on an empty index, before the first insert.
+   * @param includedSize[IN] # bytes reserved for the value in a leaf entry
+   * @return error code. 0 if no error
+   */
+  RC setCovering(int includedSize);
+
+  /**
+   * @return true if the index stores the record values in its leaves
+   */
+  bool isCovering() const { return includedSize > 0; }
+
+  /**
+   * @return # pages in the index file: the meta page, the nodes and the
+   * overflow pages of the long values of a covering index
+   */
+  int getPageCount() const { return pf.endPid(); }
+
   /**
    * Insert (key, RecordId) pair to the index.
    * @param key[IN] the key for the value inserted into the index
@@ -58,9 +111,21 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
+  /**
+   * Insert (key, RecordId) pair to the index, together with the record
+   * value if the index is a covering index.
+   * @param key[IN] the key for the value inserted into the index
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @param value[IN] the value of the record
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid, const std::string& value);
+
   /* Insert helper (recursive)
+   * rightmost is true if curPid is on the rightmost path of the tree,
+   * where a split of the last child is an append split.
   */
-  RC insertHelper(int key, const RecordId& rid, PageId curPid, int curHeight, PageId& movePid, int& moveKey);
+  RC insertHelper(int key, const RecordId& rid, const char* included, PageId curPid, int curHeight, bool rightmost, PageId& movePid, int& moveKey);
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -82,6 +147,26 @@ class BTreeIndex {
    */
   RC locate(int searchKey, IndexCursor& cursor);
 
+  /**
+   * Find the largest key in the index that is not greater than searchKey.
+   * The search descends to the leaf where searchKey would be, and if no
+   * key of that leaf is small enough, to the leaf before it. For
+   * searchKey = INT_MAX this is a single descent to the rightmost leaf.
+   * @param searchKey[IN] the largest key wanted
+   * @param key[OUT] the key found
+   * @return 0 if a key is found. RC_NO_SUCH_RECORD if every key in the
+   *         index is greater than searchKey, or another error code
+   */
+  RC locateLast(int searchKey, int& key);
+
+  /**
+   * Check the Bloom filter kept next to the index for searchKey.
+   * Costs at most one page read, instead of a root-to-leaf descent.
+   * @param searchKey[IN] the key to look up
+   * @return false if no entry with searchKey is in the index
+   */
+  bool mayContain(int searchKey) const;
+
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
@@ -92,6 +177,150 @@ class BTreeIndex {
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
 
+  /**
+   * Same as readForward() above, but also read the record value stored in
+   * a covering index, so that the table does not have to be accessed.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @param value[OUT] the record value stored at the index cursor location
+   * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE if the index
+   *         is not a covering index
+   */
+  RC readForward(IndexCursor& cursor, int& key, RecordId& rid, std::string& value);
+
+  /**
+   * Reads the entries in key order from the position found by locate(),
+   * for one of several threads reading the index at once. The nodes are
+   * read straight from the file, around the read cache and its lock, and
+   * a leaf is read once for all of its entries.
+   * The index must stay open and unchanged while the scanner is used.
+   */
+  class LeafScanner {
+   public:
+    LeafScanner(BTreeIndex& index);
+
+    /**
+     * Move to the first entry with a key not smaller than searchKey.
+     * @param searchKey[IN] the key to find
+     * @return error code. 0 if no error
+     */
+    RC locate(int searchKey);
+
+    /**
+     * Read the (key, rid) pair at the position and move forward.
+     * @param key[OUT] the key of the entry
+     * @param rid[OUT] the RecordId of the entry
+     * @return error code. RC_END_OF_TREE after the last entry
+     */
+    RC readForward(int& key, RecordId& rid);
+
+    /**
+     * Same as readForward() above, but also read the record value stored
+     * in a covering index.
+     * @param key[OUT] the key of the entry
+     * @param rid[OUT] the RecordId of the entry
+     * @param value[OUT] the record value of the entry
+     * @return error code. RC_END_OF_TREE after the last entry
+     */
+    RC readForward(int& key, RecordId& rid, std::string& value);
+
+   private:
+    RC nextEntry();
+
+    BTreeIndex& index;
+    BTLeafNode  leaf;     /// the leaf the position is in
+    int         count;    /// # entries in leaf
+    IndexCursor cursor;   /// the position. cursor.pid is -1 before locate()
+  };
+
+  /**
+   * Set how full the left node is kept when a node splits because a key
+   * was appended at its right end (e.g., auto-increment or time-ordered
+   * keys). Other splits are always half and half.
+   * @param percent[IN] the percentage of entries kept in the left node
+   */
+  void setAppendSplitPercent(int percent) { appendSplitPercent = percent; }
+
+  /**
+   * @return the key statistics of the index. Only meaningful if hasStats()
+   */
+  const IndexStats& getStats() const { return stats; }
+
+  /**
+   * @return true if the meta page carried statistics when the index was
+   *         opened, or the index has been built since
+   */
+  bool hasStats() const { return statsValid; }
+
+  /**
+   * Estimate the # index entries whose key is in [low, high].
+   * Strict bounds on integer keys are converted by the caller
+   * (e.g., key > 10 becomes low = 11).
+   * @param low[IN] the smallest key in the range
+   * @param high[IN] the largest key in the range
+   * @return the estimated # matching entries
+   */
+  int estimateRows(int low, int high) const;
+
+  /**
+   * Estimate the fraction of index entries whose key is in [low, high].
+   * @param low[IN] the smallest key in the range
+   * @param high[IN] the largest key in the range
+   * @return the selectivity between 0.0 and 1.0
+   */
+  double selectivity(int low, int high) const;
+
+  /**
+   * Estimate the # page reads needed to answer a key range [low, high]
+   * through the index: one descent, the leaves covering the range, and,
+   * if fetchRecords is true, one table page per matching entry.
+   * @param low[IN] the smallest key in the range
+   * @param high[IN] the largest key in the range
+   * @param fetchRecords[IN] true if every match has to be read from the table
+   * @return the estimated # page reads
+   */
+  int estimateScanPages(int low, int high, bool fetchRecords) const;
+
+  /**
+   * Split the key range [low, high] into up to parts sub-ranges at the
+   * separator keys of the non-leaf nodes, so that the sub-ranges can be
+   * scanned by separate cursors. The levels below the root are read only
+   * until they have enough separators in the range, and the separators
+   * used are spread evenly over the ones found.
+   * Sub-range i is [starts[i], starts[i+1] - 1]; the last one ends at high.
+   * A sub-range starts right after a separator key, so that all entries
+   * with the separator key are read by the cursor of the sub-range before.
+   * @param low[IN] the smallest key in the range
+   * @param high[IN] the largest key in the range
+   * @param parts[IN] the # sub-ranges wanted
+   * @param starts[OUT] the first key of every sub-range, starting with low
+   * @return error code. 0 if no error
+   */
+  RC splitRange(int low, int high, int parts, std::vector<int>& starts);
+
+  /**
+   * Build the tree bottom-up from entries sorted by key. Leaves are written
+   * contiguously in key order, each filled to fillPercent, and the non-leaf
+   * levels are built on top of them. The index must be empty.
+   * @param entries[IN] the entries to load, sorted by key
+   * @param fillPercent[IN] how full every node is made, in percent
+   * @return error code. 0 if no error
+   */
+  RC bulkLoad(const std::vector<IndexEntry>& entries, int fillPercent);
+
+  /**
+   * Compact the index: rebuild it with bulkLoad() into a new file and
+   * replace the index file with it. The old file stays in place and
+   * readable until the new one is complete, and the replacement is a
+   * single rename. The index must be open in write mode.
+   * @param fillPercent[IN] how full every node is made, in percent
+   * @param pagesBefore[OUT] # pages of the index file before the rebuild
+   * @param pagesAfter[OUT] # pages of the index file after the rebuild
+   * @return error code. 0 if no error
+   */
+  RC rebuild(int fillPercent, int& pagesBefore, int& pagesAfter);
+
   //testing functions
   int getTreeHeight(void);
   PageId getRootPid(void);
@@ -106,6 +335,87 @@ class BTreeIndex {
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
   char buffer[PageFile::PAGE_SIZE]; // buffer to store the rootPid treeHeight to disk
+
+  IndexStats stats;    /// key statistics stored in the meta page
+  bool     statsValid; /// true if stats describe the index
+  bool     statsDirty; /// true if the index changed since the histogram was built
+
+  int      appendSplitPercent; /// left fill of a split at the right end of a node
+  PageId   rightmostPid;       /// the rightmost leaf, or -1 if not known yet
+
+  int      includedSize; /// # value bytes in a leaf entry. 0 if not covering
+  PageId   overflowPid;  /// the last overflow page for long values, or -1
+
+  std::string indexName; /// the file name of the index
+  char     openMode;     /// the mode the index was opened in
+
+  BloomFilter bloom;     /// Bloom filter over the keys, in the .bf sidecar file
+  std::string bloomName; /// the file name of the sidecar
+  int      bloomBlocks;  /// # blocks in the sidecar. 0 if there is none
+
+  /**
+   * Load the leaf under the cursor into node, skipping to the next leaf
+   * if the cursor is behind the last entry, and move the cursor forward.
+   * @param cursor[IN/OUT] the cursor to read and advance
+   * @param node[OUT] the leaf node the cursor pointed to
+   * @param eid[OUT] the entry in node the cursor pointed to
+   * @return error code. RC_END_OF_TREE after the last entry
+   */
+  RC readCursor(IndexCursor& cursor, BTLeafNode& node, int& eid);
+
+  /**
+   * Encode value into the includedSize bytes of a covering leaf entry,
+   * spilling it to the overflow pages if it does not fit. The bytes
+   * that the encoded value does not use are set to zero.
+   */
+  RC encodeValue(const std::string& value, char* included);
+
+  /**
+   * Decode the included bytes of a covering leaf entry into value.
+   */
+  RC decodeValue(const char* included, std::string& value);
+
+  /**
+   * Read the next length bytes of the overflow pages at (pid, offset),
+   * and move (pid, offset) behind them.
+   */
+  RC readOverflow(PageId& pid, int& offset, int length, std::string& bytes);
+
+  /**
+   * @return the PageId of the rightmost leaf node
+   */
+  PageId rightmostLeaf();
+
+  /**
+   * Walk the leaf chain and collect every key, in key order.
+   * @param keys[OUT] the keys in the index
+   * @param leaves[OUT] # leaf nodes visited
+   * @return error code. 0 if no error
+   */
+  RC collectKeys(std::vector<int>& keys, int& leaves);
+
+  /**
+   * Walk the leaf chain and collect every entry, with its value if the
+   * index is covering, in key order.
+   * @param entries[OUT] the entries in the index
+   * @return error code. 0 if no error
+   */
+  RC collectEntries(std::vector<IndexEntry>& entries);
+
+  /**
+   * Recompute every field of stats from the sorted keys of the index.
+   */
+  void rebuildStats(const std::vector<int>& keys, int leaves);
+
+  /**
+   * @return the PageId of the leftmost leaf node
+   */
+  PageId leftmostLeaf();
+
+  /**
+   * Estimate the # entries with key <= searchKey from the histogram.
+   */
+  double countAtMost(int searchKey) const;
 };
 
 #endif /* BTREEINDEX_H */
@@ -4,9 +4,33 @@
 
 using namespace std;
 
+/*
+ * Return how many of numKeys entries stay in the left node of a split
+ * when splitPercent of them should. Both nodes keep at least one entry.
+ */
+static int splitPoint(int numKeys, int splitPercent) {
+    int middle = (numKeys * splitPercent + 99) / 100;
+    if (middle > numKeys - 1) {
+        middle = numKeys - 1;
+    }
+    if (middle < 1) {
+        middle = 1;
+    }
+    return middle;
+}
+
 // Constructor
-BTLeafNode::BTLeafNode() {
+BTLeafNode::BTLeafNode(int includedSize) {
     // initialize member variables
+    // a covering leaf keeps includedSize bytes of the value in every entry,
+    // so fewer entries fit in a page. the next node pointer always follows
+    // two spare entries behind the last one.
+    entrySize = LEAF_ENTRY_SIZE + includedSize;
+    if (includedSize == 0) {
+        maxKeys = MAX_NODE_SIZE;
+    } else {
+        maxKeys = (PageFile::PAGE_SIZE - (int) sizeof(PageId)) / entrySize - 2;
+    }
     numKeys = 0;
     lastIndex = 0;
     sibling = NULL;
@@ -23,6 +47,16 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf) {
     return pf.read(pid, buffer);
 }
 
+/*
+ * Read the node straight from the file, bypassing the read cache.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::readDirect(PageId pid, const PageFile& pf) {
+    return pf.readDirect(pid, buffer, 1);
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -39,17 +73,19 @@ RC BTLeafNode::write(PageId pid, PageFile& pf) {
  */
 int BTLeafNode::getKeyCount() {
     int keys = 0;
-    int k;
+    PageId pid;
     char *location = buffer;
-    char *last = buffer + (MAX_NODE_SIZE * LEAF_ENTRY_SIZE) - KEY_SIZE;
+    char *last = buffer + (maxKeys * entrySize) - KEY_SIZE;
     
+    // an empty entry is all -1 bytes. its rid.pid, unlike its key, can
+    // never be a real value, so every int is a valid key.
     while(location <= last) {
-        k = *((int*)(location + RID_SIZE));
-        if(k == -1) {
+        memcpy(&pid, location, sizeof(PageId));
+        if(pid == -1) {
             return keys;
         }
         keys++;
-        location += LEAF_ENTRY_SIZE;
+        location += entrySize;
     }
     
     return keys;
@@ -59,10 +95,11 @@ int BTLeafNode::getKeyCount() {
  * Insert a (key, rid) pair to the node.
  * @param key[IN] the key to insert
  * @param rid[IN] the RecordId to insert
+ * @param included[IN] the included value bytes of a covering leaf
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTLeafNode::insert(int key, const RecordId& rid) {
-    if (getKeyCount() >= MAX_NODE_SIZE) {
+RC BTLeafNode::insert(int key, const RecordId& rid, const char* included) {
+    if (getKeyCount() >= maxKeys) {
         return RC_NODE_FULL; // Return an error code if the node is full.
     }
     numKeys = getKeyCount();
@@ -76,13 +113,13 @@ RC BTLeafNode::insert(int key, const RecordId& rid) {
     if(rc == RC_NO_SUCH_RECORD) {
         rc = 0;
     }
-    int j = eid * LEAF_ENTRY_SIZE; // j = index to insert at
+    int j = eid * entrySize; // j = index to insert at
     
     // CASE: Inserting in the middle
     if (eid < numKeys) {
         // Move everything back by one entry
-        for (int i = LEAF_ENTRY_SIZE * MAX_NODE_SIZE; i >= j; i--) {
-            buffer[i] = buffer[i - LEAF_ENTRY_SIZE];
+        for (int i = entrySize * maxKeys; i >= j + entrySize; i--) {
+            buffer[i] = buffer[i - entrySize];
         }
     }
     
@@ -105,6 +142,11 @@ RC BTLeafNode::insert(int key, const RecordId& rid) {
         p++;
         j++;
     }
+
+    // And the included value of a covering leaf
+    if (entrySize > LEAF_ENTRY_SIZE) {
+        memcpy(buffer + j, included, entrySize - LEAF_ENTRY_SIZE);
+    }
     
     numKeys++;
     
@@ -113,16 +155,19 @@ RC BTLeafNode::insert(int key, const RecordId& rid) {
 
 /*
  * Insert the (key, rid) pair to the node
- * and split the node half and half with sibling.
+ * and split the node with sibling, half and half by default.
  * The first key of the sibling node is returned in siblingKey.
  * @param key[IN] the key to insert.
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
  * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @param splitPercent[IN] the percentage of entries that stay in this node.
+ * @param included[IN] the included value bytes of a covering leaf
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
-                              BTLeafNode& sibling, int& siblingKey) {
+                              BTLeafNode& sibling, int& siblingKey, int splitPercent,
+                              const char* included) {
     sibling.numKeys = sibling.getKeyCount();
     numKeys = getKeyCount();
     if (sibling.numKeys != 0) {
@@ -133,12 +178,12 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
     RC rc;
     int eid;
     rc = locate(key, eid);
-    int j = eid * LEAF_ENTRY_SIZE;    //insert here in buffer
+    int j = eid * entrySize;    //insert here in buffer
     
     //create space for insert
     if (eid < numKeys) {
-        for (int i = LEAF_ENTRY_SIZE * (MAX_NODE_SIZE + 1); i >= j; i--) {
-            buffer[i] = buffer[i - LEAF_ENTRY_SIZE];
+        for (int i = entrySize * (maxKeys + 1); i >= j + entrySize; i--) {
+            buffer[i] = buffer[i - entrySize];
         }
     }
     // insert record id
@@ -158,10 +203,14 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
         p++;
         j++;
     }
+    // insert included value
+    if (entrySize > LEAF_ENTRY_SIZE) {
+        memcpy(buffer + j, included, entrySize - LEAF_ENTRY_SIZE);
+    }
     numKeys++; // End insert
     
     // Split the keys
-    int middle = (numKeys / 2) + 1; // How many go in the left node (not sibling)
+    int middle = splitPoint(numKeys, splitPercent); // How many go in the left node (not sibling)
     // start at eid = middle (bc index)
     RecordId siblingRID;
     RecordId ins_rid;
@@ -174,12 +223,12 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
     siblingRID = ins_rid;
     
     //Move the second half of this node to the first half of sibling node
-    char* src = buffer + middle*LEAF_ENTRY_SIZE;
-    std::memcpy(sibling.buffer, src, (numKeys-middle)*LEAF_ENTRY_SIZE);
+    char* src = buffer + middle*entrySize;
+    std::memcpy(sibling.buffer, src, (numKeys-middle)*entrySize);
     
     // Clear the second half of this node.
-    char* begin = &buffer[middle * LEAF_ENTRY_SIZE];
-    char* end = begin + ((numKeys - middle) * LEAF_ENTRY_SIZE);
+    char* begin = &buffer[middle * entrySize];
+    char* end = begin + ((numKeys - middle) * entrySize);
     std::fill(begin, end, -1);
     
     // update numKeys
@@ -200,14 +249,13 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
  * @return 0 if searchKey is found. Otherwise return an error code.
  */
 RC BTLeafNode::locate(int searchKey, int& eid) {
-    int rc = 0;
     int numEntries = 0;
     int curEntry = 0;
     int key;
     RecordId rid;
     numKeys = getKeyCount();
-    while (numEntries <= numKeys) {
-        rc = readEntry(curEntry, key, rid);
+    while (numEntries < numKeys) {
+        readEntry(curEntry, key, rid);
         if (key == searchKey) {
             eid = curEntry;
             return 0; // Found searchKey
@@ -224,7 +272,7 @@ RC BTLeafNode::locate(int searchKey, int& eid) {
     }
     // inserting at the end
     eid = numKeys;
-    return rc;
+    return RC_NO_SUCH_RECORD;
 }
 
 /*
@@ -237,7 +285,7 @@ RC BTLeafNode::locate(int searchKey, int& eid) {
 RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid) {
     // eid = index of each entry in the node
     // each entry = 12 bytes
-    int entryIndex = eid * LEAF_ENTRY_SIZE;
+    int entryIndex = eid * entrySize;
     // for (int i = entryIndex; i < entryIndex + LEAF_ENTRY_SIZE; i += 4) {
     //   if (i == entryIndex) {
     //     rid.pid = (int)(buffer[i+3] << 24 | buffer[i+2] << 16 | buffer[i+1] << 8 | buffer[i]);
@@ -261,7 +309,7 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid) {
  */
 PageId BTLeafNode::getNextNodePtr() {
     PageId pid = -1;
-    memcpy(&pid, buffer + MAX_NODE_SIZE * LEAF_ENTRY_SIZE + LEAF_ENTRY_SIZE*2, sizeof(PageId));
+    memcpy(&pid, buffer + maxKeys * entrySize + entrySize*2, sizeof(PageId));
     return pid;
 }
 
@@ -272,10 +320,19 @@ PageId BTLeafNode::getNextNodePtr() {
  */
 RC BTLeafNode::setNextNodePtr(PageId pid) {
     char*p = (char*) &pid;
-    memcpy(buffer + (MAX_NODE_SIZE * LEAF_ENTRY_SIZE + LEAF_ENTRY_SIZE*2), p, sizeof(PageId));
+    memcpy(buffer + (maxKeys * entrySize + entrySize*2), p, sizeof(PageId));
     return 0;
 }
 
+/*
+ * Return the included value bytes of the eid entry of a covering leaf.
+ * @param eid[IN] the entry number to read
+ * @return pointer to the included value inside the node buffer
+ */
+const char* BTLeafNode::readIncluded(int eid) {
+    return buffer + eid * entrySize + LEAF_ENTRY_SIZE;
+}
+
 // Constructor
 BTNonLeafNode::BTNonLeafNode() {
     numKeys = 0;
@@ -293,6 +350,16 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf) {
     return pf.read(pid, buffer);
 }
 
+/*
+ * Read the node straight from the file, bypassing the read cache.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::readDirect(PageId pid, const PageFile& pf) {
+    return pf.readDirect(pid, buffer, 1);
+}
+
 /*
  * Write the content of the node to the page pid in the PageFile pf.
  * @param pid[IN] the PageId to write to
@@ -309,13 +376,14 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf) {
  */
 int BTNonLeafNode::getKeyCount() {
     int keys = 0;
-    int k;
+    PageId pid;
     char *location = buffer;
     char *last = buffer + (MAX_NODE_SIZE * NON_LEAF_ENTRY_SIZE) - KEY_SIZE;
     
+    // an empty entry is all -1 bytes, and no child is page -1
     while(location <= last) {
-        k = *((int*)(location + KEY_SIZE));
-        if(k == -1) {
+        memcpy(&pid, location, sizeof(PageId));
+        if(pid == -1) {
             return keys;
         }
         keys++;
@@ -329,30 +397,28 @@ int BTNonLeafNode::getKeyCount() {
  * Insert a (key, pid) pair to the node.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
+ * @param leftPid[IN] the child whose entry the new one follows, or -1
  * @return 0 if successful. Return an error code if the node is full.
  */
-RC BTNonLeafNode::insert(int key, PageId pid) {
+RC BTNonLeafNode::insert(int key, PageId pid, PageId leftPid) {
     
     if (getKeyCount() >= MAX_NODE_SIZE) {
         return RC_NODE_FULL; // Return an error code if the node is full.
     }
     numKeys = getKeyCount();
     
-    RC rc;
+    RC rc = 0;
     int eid;
     char* p;
     
     // LOCATE where to insert this key
-    rc = nonLeafLocate(key, eid);
-    if(rc == RC_NO_SUCH_RECORD) {
-        rc = 0;
-    }
+    eid = insertPosition(key, leftPid);
     int j = eid * NON_LEAF_ENTRY_SIZE; // j = index to insert at
     
     // CASE: Inserting in the middle
     if (eid < numKeys) {
         // Move everything back by one entry
-        for (int i = NON_LEAF_ENTRY_SIZE * MAX_NODE_SIZE; i >= j; i--) {
+        for (int i = NON_LEAF_ENTRY_SIZE * MAX_NODE_SIZE; i >= j + NON_LEAF_ENTRY_SIZE; i--) {
             buffer[i] = buffer[i - NON_LEAF_ENTRY_SIZE];
         }
     }
@@ -397,15 +463,35 @@ RC BTNonLeafNode::readNonLeafEntry(int eid, int& key, PageId& pid) {
     return 0;
 }
 
+/*
+ * Find the entry number a new (key, pid) pair is inserted at. Keys equal
+ * to key do not tell where among them the pair goes, so it goes right
+ * after the entry of leftPid, or after the last key not greater than key
+ * when leftPid is -1.
+ */
+int BTNonLeafNode::insertPosition(int key, PageId leftPid) {
+    int k;
+    PageId p;
+    int eid;
+    numKeys = getKeyCount();
+    
+    for (eid = 0; eid < numKeys; eid++) {
+        readNonLeafEntry(eid, k, p);
+        if (leftPid != -1 ? p == leftPid : k > key) {
+            return (leftPid != -1) ? eid + 1 : eid;
+        }
+    }
+    return numKeys;
+}
+
 RC BTNonLeafNode::nonLeafLocate(int searchKey, int& eid) {
-    RC rc;
     int numEntries = 0;
     int curEntry = 0;
     int key;
     PageId pid;
     numKeys = getKeyCount();
-    while (numEntries <= numKeys) {
-        rc = readNonLeafEntry(curEntry, key, pid);
+    while (numEntries < numKeys) {
+        readNonLeafEntry(curEntry, key, pid);
         if (key == searchKey) {
             eid = curEntry;
             return 0; // Found searchKey
@@ -422,18 +508,19 @@ RC BTNonLeafNode::nonLeafLocate(int searchKey, int& eid) {
     }
     // inserting at the end
     eid = numKeys;
-    return rc;
+    return RC_NO_SUCH_RECORD;
 }
 
 
 /*
  * Insert the (key, pid) pair to the node
- * and split the node half and half with sibling.
+ * and split the node with sibling, half and half by default.
  * The middle key after the split is returned in midKey.
  * @param key[IN] the key to insert
  * @param pid[IN] the PageId to insert
  * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
  * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+ * @param splitPercent[IN] the percentage of entries that stay in this node.
  * @return 0 if successful. Return an error code if there is an error.
  */
 
@@ -443,7 +530,7 @@ RC BTNonLeafNode::nonLeafLocate(int searchKey, int& eid) {
  * Node gets split down the middle, and the very middle element is discarded (moved up one level in B+Tree)
  * 1st->35th, 36th, 37th-71st node. 36th node gets returned
  */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey) {
+RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int splitPercent, PageId leftPid) {
     sibling.numKeys = sibling.getKeyCount();
     numKeys = getKeyCount();
     if (sibling.numKeys != 0) {
@@ -452,13 +539,12 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
     
     // Do insert as before
     RC rc;
-    int eid;
-    rc = nonLeafLocate(key, eid);
+    int eid = insertPosition(key, leftPid);
     int j = eid * NON_LEAF_ENTRY_SIZE;    //insert here in buffer
     
     //create space for insert
     if (eid < numKeys) {
-        for (int i = NON_LEAF_ENTRY_SIZE * (MAX_NODE_SIZE + 1); i >= j; i--) {
+        for (int i = NON_LEAF_ENTRY_SIZE * (MAX_NODE_SIZE + 1); i >= j + NON_LEAF_ENTRY_SIZE; i--) {
             buffer[i] = buffer[i - NON_LEAF_ENTRY_SIZE];
         }
     }
@@ -481,9 +567,8 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
     numKeys++; // End insert
     
     // Split the keys
-    int middle = numKeys / 2 + 1;
-    int left = numKeys / 2;            //1 - 35
-    int right = (numKeys / 2) + 2;      //37 - 71
+    int middle = splitPoint(numKeys, splitPercent);
+    int left = middle - 1;             //1 - 35 on a half and half split
     
     // Copy right (middle.....right) side into sibling
     char* src = buffer + middle * NON_LEAF_ENTRY_SIZE;
@@ -548,6 +633,34 @@ RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid) {
     return rc;
 }
 
+/*
+ * Find the leftmost child that can hold searchKey: the child of the last
+ * entry whose key is smaller than searchKey, or the first child.
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param pid[OUT] the pointer to the child node to follow.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::locateFirstChildPtr(int searchKey, PageId& pid) {
+    RC rc;
+    int key;
+    PageId entry_pid;
+    int curEntry = 1;
+    numKeys = getKeyCount();
+    
+    // the first key is smaller than any other, so the first child is the
+    // answer unless a later key is smaller than searchKey too
+    while (curEntry < numKeys) {
+        if ((rc = readNonLeafEntry(curEntry, key, entry_pid)) != 0) {
+            return rc;
+        }
+        if (key >= searchKey) {
+            break;
+        }
+        curEntry++;
+    }
+    return readNonLeafEntry(curEntry - 1, key, pid);
+}
+
 /*
  * Initialize the root node with (pid1, key, pid2).
  * @param pid1[IN] the first PageId to insert
@@ -582,8 +695,9 @@ void BTLeafNode::printStuff() {
     cerr << "Printing results..." << endl;
     
     char* traverse = buffer;
+    int count = getKeyCount();
     
-    while (*traverse != -1) {
+    for (int i = 0; i < count; i++) {
         int key;
         RecordId recordId;
         
@@ -598,7 +712,7 @@ void BTLeafNode::printStuff() {
         cerr << " RecordId.sid: " << recordId.sid;
         cerr << endl;
         
-        traverse += 12;
+        traverse += entrySize;
     }
     
     cerr << "numKeys: " << getKeyCount() << endl;
@@ -610,8 +724,9 @@ void BTNonLeafNode::printStuff() {
     cerr << "Printing results..." << endl;
     
     char* traverse = buffer;
+    int count = getKeyCount();
     
-    while (*traverse != -1) {
+    for (int i = 0; i < count; i++) {
         int key;
         PageId pid;
         
@@ -18,35 +18,46 @@ const int RID_SIZE = 8;
 const int LEAF_ENTRY_SIZE = 12;
 const int NON_LEAF_ENTRY_SIZE = 8;
 const int MAX_NODE_SIZE = 70; // 70 keys in a node
+const int COVERING_VALUE_SIZE = 36; // value bytes in a covering leaf entry
+const int APPEND_SPLIT_PERCENT = 90; // % of entries kept on the left when a node splits at its right end
+const int REBUILD_FILL_PERCENT = 90; // % of a node filled when an index is rebuilt
 
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
  */
 class BTLeafNode {
   public:
-    // Constructor
-    BTLeafNode();
+   /**
+    * Constructor
+    * @param includedSize[IN] # bytes of the value stored in every entry of
+    *                         a covering index leaf. 0 for a plain leaf.
+    */
+    BTLeafNode(int includedSize = 0);
    /**
     * Insert the (key, rid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param rid[IN] the RecordId to insert
+    * @param included[IN] includedSize bytes to store with the entry
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, const RecordId& rid);
+    RC insert(int key, const RecordId& rid, const char* included = NULL);
 
    /**
     * Insert the (key, rid) pair to the node
-    * and split the node half and half with sibling.
+    * and split the node with sibling, half and half by default.
     * The first key of the sibling node is returned in siblingKey.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert.
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
     * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @param splitPercent[IN] the percentage of entries that stay in this node.
+    * @param included[IN] includedSize bytes to store with the entry
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+    RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey, int splitPercent = 50,
+                      const char* included = NULL);
 
    /**
     * If searchKey exists in the node, set eid to the index entry
@@ -70,6 +81,13 @@ class BTLeafNode {
     */
     RC readEntry(int eid, int& key, RecordId& rid);
 
+   /**
+    * Return the included value bytes stored in the eid entry
+    * of a covering index leaf.
+    * @param eid[IN] the entry number to read
+    * @return pointer to the includedSize bytes of the entry
+    */
+    const char* readIncluded(int eid);
    /**
     * Return the pid of the next slibling node.
     * @return the PageId of the next sibling node
@@ -90,6 +108,12 @@ class BTLeafNode {
     */
     int getKeyCount();
 
+   /**
+    * Return the number of keys that fit in the node.
+    * @return the capacity of the node
+    */
+    int getMaxKeyCount() { return maxKeys; }
+
    /**
     * Read the content of the node from the page pid in the PageFile pf.
     * @param pid[IN] the PageId to read
@@ -98,6 +122,15 @@ class BTLeafNode {
     */
     RC read(PageId pid, const PageFile& pf);
 
+   /**
+    * Same as read(), but straight from the file, bypassing the read
+    * cache, so that several threads can read nodes at once.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readDirect(PageId pid, const PageFile& pf);
+
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -112,6 +145,8 @@ class BTLeafNode {
     * that contains the node.
     */
     char buffer[PageFile::PAGE_SIZE];
+    int entrySize; // LEAF_ENTRY_SIZE plus the included value bytes
+    int maxKeys;   // # entries that fit in the node
     int numKeys;
     int lastIndex;
     BTLeafNode* sibling;
@@ -131,9 +166,11 @@ class BTNonLeafNode {
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
+    * @param leftPid[IN] the child whose entry the new one follows. -1 to
+    *                   insert it after every key not greater than key.
     * @return 0 if successful. Return an error code if the node is full.
     */
-    RC insert(int key, PageId pid);
+    RC insert(int key, PageId pid, PageId leftPid = -1);
 
     /**
     * readEntry but for pid instead of rid
@@ -144,7 +181,7 @@ class BTNonLeafNode {
 
    /**
     * Insert the (key, pid) pair to the node
-    * and split the node half and half with sibling.
+    * and split the node with sibling, half and half by default.
     * The sibling node MUST be empty when this function is called.
     * The middle key after the split is returned in midKey.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -152,9 +189,11 @@ class BTNonLeafNode {
     * @param pid[IN] the PageId to insert
     * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
     * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param splitPercent[IN] the percentage of entries that stay in this node.
+    * @param leftPid[IN] the child whose entry the new one follows, as for insert().
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+    RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey, int splitPercent = 50, PageId leftPid = -1);
 
    /**
     * Given the searchKey, find the child-node pointer to follow and
@@ -166,6 +205,16 @@ class BTNonLeafNode {
     */
     RC locateChildPtr(int searchKey, PageId& pid);
 
+   /**
+    * Find the leftmost child that can hold searchKey: the child left of
+    * a key equal to searchKey, because a split may leave copies of its
+    * first key at the end of the left node.
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param pid[OUT] the pointer to the child node to follow.
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC locateFirstChildPtr(int searchKey, PageId& pid);
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
@@ -189,6 +238,15 @@ class BTNonLeafNode {
     */
     RC read(PageId pid, const PageFile& pf);
 
+   /**
+    * Same as read(), but straight from the file, bypassing the read
+    * cache, so that several threads can read nodes at once.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readDirect(PageId pid, const PageFile& pf);
+
    /**
     * Write the content of the node to the page pid in the PageFile pf.
     * @param pid[IN] the PageId to write to
@@ -207,6 +265,9 @@ class BTNonLeafNode {
     char buffer[PageFile::PAGE_SIZE];
     int numKeys;
     int lastIndex;
+
+    // the entry number insert() puts a (key, pid) pair at
+    int insertPosition(int key, PageId leftPid);
 };
 
 #endif /* BTREENODE_H */
@@ -0,0 +1,125 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "BloomFilter.h"
+#include <cstring>
+#include <stdint.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using std::string;
+using std::vector;
+
+// odd constants that spread one hash into the eight words of a block
+static const uint32_t SALT[BloomFilter::BLOCK_WORDS] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+  0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+// 64-bit mix of the key. the upper half picks the block,
+// the lower half the bits inside the block.
+static uint64_t hashKey(int key)
+{
+  uint64_t h = (uint32_t) key;
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+
+static int blockOf(uint64_t h, int blockCount)
+{
+  return (int) (((h >> 32) * (uint64_t) blockCount) >> 32);
+}
+
+// set the bit of every word of the block that the hash selects
+static void setBits(uint32_t* block, uint32_t h)
+{
+  for (int i = 0; i < BloomFilter::BLOCK_WORDS; i++) {
+    block[i] |= 1U << ((h * SALT[i]) >> 27);
+  }
+}
+
+// test the bit of every word of the block that the hash selects
+static bool testBits(const uint32_t* block, uint32_t h)
+{
+#ifdef __AVX2__
+  __m256i salt = _mm256_loadu_si256((const __m256i*) SALT);
+  __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(h), salt), 27);
+  __m256i mask = _mm256_sllv_epi32(_mm256_set1_epi32(1), bits);
+  return _mm256_testc_si256(_mm256_loadu_si256((const __m256i*) block), mask);
+#else
+  uint32_t missing = 0;
+  for (int i = 0; i < BloomFilter::BLOCK_WORDS; i++) {
+    missing |= ~block[i] & (1U << ((h * SALT[i]) >> 27));
+  }
+  return missing == 0;
+#endif
+}
+
+BloomFilter::BloomFilter()
+{
+  blockCount = 0;
+}
+
+RC BloomFilter::open(const string& filename, char mode, int count)
+{
+  RC rc;
+  if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  blockCount = count;
+  return 0;
+}
+
+RC BloomFilter::close()
+{
+  blockCount = 0;
+  return pf.close();
+}
+
+RC BloomFilter::build(const vector<int>& keys)
+{
+  RC rc;
+
+  // round up to whole pages; the extra blocks only lower the false positive rate
+  int bits = keys.size() * BITS_PER_KEY;
+  int pages = (bits + PageFile::PAGE_SIZE * 8 - 1) / (PageFile::PAGE_SIZE * 8);
+  if (pages == 0) pages = 1;
+  blockCount = pages * BLOCKS_PER_PAGE;
+
+  vector<uint32_t> words(blockCount * BLOCK_WORDS, 0);
+  for (unsigned i = 0; i < keys.size(); i++) {
+    uint64_t h = hashKey(keys[i]);
+    setBits(&words[blockOf(h, blockCount) * BLOCK_WORDS], (uint32_t) h);
+  }
+
+  for (int pid = 0; pid < pages; pid++) {
+    if ((rc = pf.write(pid, &words[pid * BLOCKS_PER_PAGE * BLOCK_WORDS])) < 0) {
+      blockCount = 0;
+      return rc;
+    }
+  }
+
+  return 0;
+}
+
+bool BloomFilter::mayContain(int key) const
+{
+  uint32_t page[PageFile::PAGE_SIZE / sizeof(uint32_t)];
+
+  // without a filter every key may be there
+  if (blockCount == 0) return true;
+
+  uint64_t h = hashKey(key);
+  int block = blockOf(h, blockCount);
+  if (pf.read(block / BLOCKS_PER_PAGE, page) < 0) return true;
+
+  return testBits(page + (block % BLOCKS_PER_PAGE) * BLOCK_WORDS, (uint32_t) h);
+}
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BLOOMFILTER_H
+#define BLOOMFILTER_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * A split-block Bloom filter over the keys of an index, stored in its own
+ * PageFile next to the index. Every key sets one bit in each of the eight
+ * 32-bit words of a single 32-byte block, so a lookup reads exactly one
+ * page and tests one block with eight independent bit probes.
+ */
+class BloomFilter {
+ public:
+
+  static const int BITS_PER_KEY = 10;   // ~1% false positives
+  static const int BLOCK_WORDS = 8;     // 32-bit words in a block
+  static const int BLOCK_SIZE = BLOCK_WORDS * 4;
+  static const int BLOCKS_PER_PAGE = PageFile::PAGE_SIZE / BLOCK_SIZE;
+
+  BloomFilter();
+
+  /**
+   * open the filter file in read or write mode.
+   * @param filename[IN] the name of the filter file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @param blockCount[IN] # blocks in the filter, as returned by build()
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename, char mode, int blockCount);
+
+  /**
+   * close the filter file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * (re)build the filter from all keys of the index and write it to the file.
+   * @param keys[IN] every key in the index
+   * @return error code. 0 if no error
+   */
+  RC build(const std::vector<int>& keys);
+
+  /**
+   * check whether key may be in the index. false positives are possible,
+   * false negatives are not. reads at most one page.
+   * @param key[IN] the key to look up
+   * @return false if key is definitely not in the index
+   */
+  bool mayContain(int key) const;
+
+  /**
+   * @return # blocks in the filter. 0 if the filter is not built
+   */
+  int getBlockCount() const { return blockCount; }
+
+ private:
+  PageFile pf;        // the PageFile storing the blocks, BLOCKS_PER_PAGE per page
+  int      blockCount;
+};
+
+#endif // BLOOMFILTER_H
@@ -0,0 +1,1326 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "Operator.h"
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <climits>
+#include <algorithm>
+#include <unistd.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+using std::string;
+using std::vector;
+
+/*
+ * find the keys in the inclusive range [low, high] among keys[0..n-1].
+ * the matching keys are copied to out, in order.
+ * @return # matching keys
+ */
+static int filterKeys(const int* keys, int n, int low, int high, int* out)
+{
+  int count = 0;
+  int i = 0;
+
+#ifdef __AVX2__
+  // compare eight keys at a time; a key is out of range if low > key
+  // or key > high
+  __m256i vlow = _mm256_set1_epi32(low);
+  __m256i vhigh = _mm256_set1_epi32(high);
+  for (; i + 8 <= n; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i*) (keys + i));
+    __m256i out8 = _mm256_or_si256(_mm256_cmpgt_epi32(vlow, k), _mm256_cmpgt_epi32(k, vhigh));
+    int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(out8)) & 0xff;
+    while (mask) {
+      out[count++] = keys[i + __builtin_ctz(mask)];
+      mask &= mask - 1;
+    }
+  }
+#endif
+
+  for (; i < n; i++) {
+    out[count] = keys[i];
+    count += (keys[i] >= low) & (keys[i] <= high);
+  }
+
+  return count;
+}
+
+/*
+ * find the positions of the keys in the inclusive range [low, high]
+ * among keys[0..n-1], without a branch per key.
+ * @return # matching keys
+ */
+static int selectKeys(const int* keys, int n, int low, int high, int* sel)
+{
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    sel[count] = i;
+    count += (keys[i] >= low) & (keys[i] <= high);
+  }
+  return count;
+}
+
+RowBatch::RowBatch()
+{
+  n = 0;
+  limit = CAPACITY;
+  owned.reserve(CAPACITY);
+}
+
+void RowBatch::grow(int added)
+{
+  for (int i = n; i < n + added; i++) {
+    data[i] = NULL;
+    length[i] = 0;
+  }
+  n += added;
+}
+
+void RowBatch::addCopy(int key, const char* value, int len)
+{
+  // owned has room for CAPACITY values, so earlier copies never move
+  owned.push_back(string(value, len));
+  add(key, owned.back().data(), len);
+}
+
+void RowBatch::select(const char* keep)
+{
+  int m = 0;
+  for (int i = 0; i < n; i++) {
+    keyArray[m] = keyArray[i];
+    data[m] = data[i];
+    length[m] = length[i];
+    m += (keep[i] != 0);
+  }
+  n = m;
+}
+
+TableScan::TableScan(const RecordFile& rf, const Predicate& pred, bool values)
+  : scan(rf), pred(pred)
+{
+  this->values = values;
+  pos = 0;
+
+  // pages whose keys all fall outside the key range are not read
+  scan.setKeyRange(pred.low(), pred.high());
+}
+
+RC TableScan::next(RowBatch& batch)
+{
+  RC          rc;
+  const char* data;
+  int         length;
+  int         sel[RecordFile::KEYS_PER_PAGE];
+
+  batch.clear();
+  for (;;) {
+    if (pos == scan.count()) {
+      // the values of a batch may point into the loaded page
+      if (values && batch.count() > 0) return 0;
+      if ((rc = scan.nextPage()) < 0) {
+        return (rc == RC_END_OF_FILE && batch.count() > 0) ? 0 : rc;
+      }
+      pos = 0;
+    }
+
+    const int* keys = scan.keys() + pos;
+    int n = scan.count() - pos;
+    if (n > batch.room()) n = batch.room();
+
+    if (!values && !pred.hasExclusions()) {
+      // the keys in the range go to the batch in bulk
+      batch.grow(filterKeys(keys, n, pred.low(), pred.high(), batch.end()));
+    } else {
+      // the value is only read for the keys that pass the key conditions
+      int m = selectKeys(keys, n, pred.low(), pred.high(), sel);
+      for (int j = 0; j < m; j++) {
+        int key = keys[sel[j]];
+        if (!pred.notExcluded(key)) continue;
+        if (!values) {
+          batch.add(key);
+          continue;
+        }
+        if ((rc = scan.value(pos + sel[j], data, length)) < 0) return rc;
+        if (scan.valueInPage(pos + sel[j])) {
+          batch.add(key, data, length);
+        } else {
+          batch.addCopy(key, data, length);
+        }
+      }
+    }
+    pos += n;
+
+    if (batch.full()) return 0;
+  }
+}
+
+ParallelScan::ParallelScan(const Predicate& pred, bool values)
+  : pred(pred)
+{
+  this->values = values;
+  ahead = 0;
+  taken = current = released = pos = 0;
+  stop = false;
+
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&scanned, NULL);
+  pthread_cond_init(&advanced, NULL);
+}
+
+ParallelScan::~ParallelScan()
+{
+  finish();
+
+  pthread_cond_destroy(&advanced);
+  pthread_cond_destroy(&scanned);
+  pthread_mutex_destroy(&lock);
+}
+
+int ParallelScan::workersFor(int pages)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  int  morselCount = (pages + MORSEL_PAGES - 1) / MORSEL_PAGES;
+
+  int workers = (cores < morselCount) ? (int) cores : morselCount;
+  if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+  return (workers > 1) ? workers : 1;
+}
+
+void ParallelScan::addMorsel(int first, int last)
+{
+  Morsel m;
+  m.first = first;
+  m.last = last;
+  m.done = false;
+  m.rc = 0;
+  morsels.push_back(m);
+}
+
+void ParallelScan::keep(Morsel& m, int key, const char* value, int length)
+{
+  if (values) {
+    m.offsets.push_back(m.heap.size());
+    m.heap.append(value, length);
+  }
+  m.keys.push_back(key);
+}
+
+void ParallelScan::start(int workers)
+{
+  if (workers > MAX_WORKERS) workers = MAX_WORKERS;
+  ahead = AHEAD_MORSELS * workers;
+
+  // if no thread can be started, next() scans the morsels itself
+  for (int i = 0; i < workers; i++) {
+    pthread_t t;
+    if (pthread_create(&t, NULL, work, this) != 0) break;
+    threads.push_back(t);
+  }
+}
+
+void ParallelScan::finish()
+{
+  pthread_mutex_lock(&lock);
+  stop = true;
+  pthread_cond_broadcast(&advanced);
+  pthread_mutex_unlock(&lock);
+
+  for (unsigned i = 0; i < threads.size(); i++) {
+    pthread_join(threads[i], NULL);
+  }
+  threads.clear();
+}
+
+void* ParallelScan::work(void* arg)
+{
+  ((ParallelScan*) arg)->run();
+  return NULL;
+}
+
+/*
+ * the loop of a worker: take the next morsel and scan it, until every
+ * morsel is taken or the scan is stopped.
+ */
+void ParallelScan::run()
+{
+  for (;;) {
+    pthread_mutex_lock(&lock);
+    while (!stop && taken < (int) morsels.size() && taken >= current + ahead) {
+      pthread_cond_wait(&advanced, &lock);
+    }
+    if (stop || taken == (int) morsels.size()) {
+      pthread_mutex_unlock(&lock);
+      return;
+    }
+    Morsel& m = morsels[taken++];
+    pthread_mutex_unlock(&lock);
+
+    RC rc = scanMorsel(m);
+
+    pthread_mutex_lock(&lock);
+    m.rc = rc;
+    m.done = true;
+    pthread_cond_broadcast(&scanned);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+RC ParallelScan::next(RowBatch& batch)
+{
+  batch.clear();
+
+  // the rows of the morsels finished by the last call are not used any more
+  for (; released < current; released++) {
+    std::vector<int>().swap(morsels[released].keys);
+    std::vector<int>().swap(morsels[released].offsets);
+    string().swap(morsels[released].heap);
+  }
+
+  while (!batch.full() && current < (int) morsels.size()) {
+    Morsel& m = morsels[current];
+
+    pthread_mutex_lock(&lock);
+    if (threads.empty() && taken == current) {
+      taken++;
+      pthread_mutex_unlock(&lock);
+      m.rc = scanMorsel(m);
+      m.done = true;
+      pthread_mutex_lock(&lock);
+    }
+    while (!m.done) {
+      pthread_cond_wait(&scanned, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (m.rc < 0) return m.rc;
+
+    int n = m.keys.size();
+    int room = batch.room();
+    if (!values) {
+      int k = (n - pos < room) ? n - pos : room;
+      if (k > 0) memcpy(batch.end(), &m.keys[pos], k * sizeof(int));
+      batch.grow(k);
+      pos += k;
+    } else {
+      for (; pos < n && !batch.full(); pos++) {
+        int end = (pos + 1 < n) ? m.offsets[pos + 1] : (int) m.heap.size();
+        batch.add(m.keys[pos], m.heap.data() + m.offsets[pos], end - m.offsets[pos]);
+      }
+    }
+
+    if (pos == n) {
+      pos = 0;
+      pthread_mutex_lock(&lock);
+      current++;
+      pthread_cond_broadcast(&advanced);
+      pthread_mutex_unlock(&lock);
+    }
+  }
+
+  return (batch.count() > 0) ? 0 : RC_END_OF_FILE;
+}
+
+ParallelTableScan::ParallelTableScan(const RecordFile& rf, const Predicate& pred,
+                                     bool values, int workers)
+  : ParallelScan(pred, values), rf(rf)
+{
+  for (PageId pid = rf.beginRid().pid; pid <= rf.endRid().pid; pid += MORSEL_PAGES) {
+    addMorsel(pid, pid + MORSEL_PAGES - 1);
+  }
+  start(workers);
+}
+
+ParallelTableScan::~ParallelTableScan()
+{
+  // the workers use rf until they are joined
+  finish();
+}
+
+/*
+ * scan the pages of a morsel and keep the rows that match.
+ */
+RC ParallelTableScan::scanMorsel(Morsel& m)
+{
+  RC          rc;
+  const char* data = NULL;
+  int         length = 0;
+  int         sel[RecordFile::KEYS_PER_PAGE];
+
+  RecordFile::Scanner scan(rf);
+  scan.setKeyRange(pred.low(), pred.high());
+  scan.setPageRange(m.first, m.last);
+
+  while ((rc = scan.nextPage()) == 0) {
+    const int* keys = scan.keys();
+    int n = selectKeys(keys, scan.count(), pred.low(), pred.high(), sel);
+
+    for (int j = 0; j < n; j++) {
+      int key = keys[sel[j]];
+      if (!pred.notExcluded(key)) continue;
+      if (values) {
+        if ((rc = scan.value(sel[j], data, length)) < 0) return rc;
+        if (!pred.matchValue(key, data, length)) continue;
+      }
+      keep(m, key, data, length);
+    }
+  }
+
+  return (rc == RC_END_OF_FILE) ? 0 : rc;
+}
+
+ParallelIndexScan::ParallelIndexScan(BTreeIndex& index, const RecordFile& rf,
+                                     const Predicate& pred, IndexRangeScan::Mode mode,
+                                     int workers)
+  : ParallelScan(pred, mode != IndexRangeScan::KEYS_ONLY), index(index), rf(rf)
+{
+  vector<int> starts;
+
+  this->mode = mode;
+
+  // a few sub-ranges per worker even out the differences between them
+  if (index.splitRange(pred.low(), pred.high(), AHEAD_MORSELS * workers, starts) != 0) {
+    starts.assign(1, pred.low());
+  }
+
+  // with OR, the sub-ranges are also cut at the gaps between the key
+  // ranges, so that no cursor reads the entries of a gap
+  int r = 0;
+  for (unsigned i = 0; i < starts.size(); i++) {
+    int last = (i + 1 < starts.size()) ? starts[i + 1] - 1 : pred.high();
+    for (; r < pred.rangeCount() && pred.rangeLow(r) <= last; r++) {
+      addMorsel(std::max(starts[i], pred.rangeLow(r)), std::min(last, pred.rangeHigh(r)));
+      if (pred.rangeHigh(r) > last) break;
+    }
+  }
+  start(workers);
+}
+
+ParallelIndexScan::~ParallelIndexScan()
+{
+  // the workers use index and rf until they are joined
+  finish();
+}
+
+/*
+ * read the index entries of a sub-range with a scanner of its own, which
+ * reads the leaves around the page cache, and keep the rows that match.
+ */
+RC ParallelIndexScan::scanMorsel(Morsel& m)
+{
+  RC          rc;
+  int         key;
+  RecordId    rid;
+  string      value;
+
+  vector<IndexRangeScan::Entry> entries;
+
+  BTreeIndex::LeafScanner scan(index);
+  if ((rc = scan.locate(m.first)) != 0) return rc;
+  for (;;) {
+    rc = (mode == IndexRangeScan::COVERING) ? scan.readForward(key, rid, value)
+                                            : scan.readForward(key, rid);
+
+    // the keys come in order, so the first key past the range ends the scan
+    if (rc != 0 || key > m.last) break;
+    if (key < m.first || !pred.notExcluded(key)) continue;
+
+    switch (mode) {
+    case IndexRangeScan::KEYS_ONLY:
+      keep(m, key, NULL, 0);
+      break;
+    case IndexRangeScan::COVERING:
+      if (pred.matchValue(key, value.data(), value.size())) {
+        keep(m, key, value.data(), value.size());
+      }
+      break;
+    case IndexRangeScan::FETCH: {
+      IndexRangeScan::Entry e;
+      e.key = key;
+      e.rid = rid;
+      entries.push_back(e);
+      if ((int) entries.size() == IndexRangeScan::FETCH_BATCH_SIZE &&
+          (rc = fetch(entries, m)) < 0) return rc;
+      break;
+    }
+    }
+  }
+
+  return fetch(entries, m);
+}
+
+/*
+ * read the records of index entries in page order, each page once, and
+ * keep the rows that match. the pages are read around the page cache.
+ */
+RC ParallelIndexScan::fetch(vector<IndexRangeScan::Entry>& entries, Morsel& m)
+{
+  RC          rc;
+  const char* data;
+  int         length;
+
+  std::sort(entries.begin(), entries.end(), IndexRangeScan::ridLess);
+
+  RecordFile::Scanner scan(rf);
+  for (unsigned j = 0; j < entries.size(); j++) {
+    const RecordId& rid = entries[j].rid;
+    if ((j == 0 || rid.pid != entries[j - 1].rid.pid) && (rc = scan.readPage(rid.pid)) < 0) {
+      return rc;
+    }
+    if (rid.sid >= scan.count()) return RC_INVALID_RID;
+    if ((rc = scan.value(rid.sid, data, length)) < 0) return rc;
+    if (pred.matchValue(entries[j].key, data, length)) keep(m, entries[j].key, data, length);
+  }
+
+  entries.clear();
+  return 0;
+}
+
+IndexRangeScan::IndexRangeScan(BTreeIndex& index, const RecordFile& rf,
+                               const Predicate& pred, Mode mode, bool keyOrder)
+  : index(index), rf(rf), pred(pred)
+{
+  this->mode = mode;
+  this->keyOrder = keyOrder;
+  started = done = false;
+  range = 0;
+  pos = 0;
+  readAhead = (mode == FETCH) && !keyOrder && rf.isClustered();
+  fetched = -1;
+}
+
+bool IndexRangeScan::ridLess(const Entry& a, const Entry& b)
+{
+  return a.rid < b.rid;
+}
+
+/*
+ * read the next index entry in the key range that no <> excludes.
+ */
+RC IndexRangeScan::readEntry(int& key, RecordId& rid)
+{
+  RC rc;
+
+  if (!started) {
+    index.locate(pred.low(), cursor);
+    started = true;
+  }
+
+  while (!done) {
+    rc = (mode == COVERING) ? index.readForward(cursor, key, rid, value)
+                            : index.readForward(cursor, key, rid);
+
+    // the keys come in order, so the first key past the last range ends
+    // the scan, and a key past another range moves the cursor to the next
+    // range the key has not passed
+    if (rc != 0 || key > pred.high()) {
+      done = true;
+      break;
+    }
+    if (key > pred.rangeHigh(range)) {
+      while (key > pred.rangeHigh(range)) range++;
+      if (key < pred.rangeLow(range)) {
+        index.locate(pred.rangeLow(range), cursor);
+        continue;
+      }
+    }
+    if (key >= pred.low() && pred.notExcluded(key)) return 0;
+  }
+
+  return RC_END_OF_FILE;
+}
+
+/*
+ * collect the next FETCH_BATCH_SIZE entries and sort them by record id.
+ */
+RC IndexRangeScan::collect()
+{
+  Entry e;
+
+  pending.clear();
+  pos = 0;
+  fetched = -1;
+
+  while ((int) pending.size() < FETCH_BATCH_SIZE && readEntry(e.key, e.rid) == 0) {
+    pending.push_back(e);
+  }
+  std::sort(pending.begin(), pending.end(), ridLess);
+
+  return 0;
+}
+
+RC IndexRangeScan::next(RowBatch& batch)
+{
+  RC          rc;
+  int         key;
+  RecordId    rid;
+  const char* data;
+  int         length;
+
+  batch.clear();
+
+  if (mode != FETCH || keyOrder) {
+    while (!batch.full() && readEntry(key, rid) == 0) {
+      if (mode == FETCH) {
+        // the record is read into a buffer that the next read reuses
+        if ((rc = rf.read(rid, key, data, length, record)) < 0) return rc;
+        batch.addCopy(key, data, length);
+      } else if (mode == COVERING) {
+        batch.addCopy(key, value.data(), value.size());
+      } else {
+        batch.add(key);
+      }
+    }
+    return (batch.count() > 0) ? 0 : RC_END_OF_FILE;
+  }
+
+  while (!batch.full()) {
+    if (pos == pending.size()) {
+      if (done) break;
+      collect();
+      if (pending.empty()) break;
+    }
+
+    const Entry& e = pending[pos++];
+    if (readAhead && e.rid.pid > fetched) {
+      int n = pending.back().rid.pid - e.rid.pid + 1;
+      if (n > READ_AHEAD_PAGES) n = READ_AHEAD_PAGES;
+      rf.prefetch(e.rid.pid, n);
+      fetched = e.rid.pid + n - 1;
+    }
+
+    // the record is read into a buffer that the next read reuses
+    if ((rc = rf.read(e.rid, key, data, length, record)) < 0) return rc;
+    batch.addCopy(key, data, length);
+  }
+
+  return (batch.count() > 0) ? 0 : RC_END_OF_FILE;
+}
+
+KeyBoundsScan::KeyBoundsScan(BTreeIndex& index, const Predicate& pred)
+  : index(index), pred(pred)
+{
+  done = false;
+}
+
+RC KeyBoundsScan::next(RowBatch& batch)
+{
+  RC          rc;
+  IndexCursor cursor;
+  RecordId    rid;
+  int         first, last;
+
+  if (done) return RC_END_OF_FILE;
+  done = true;
+
+  // the first key of the range is read where a range scan would start
+  cursor.pid = -1;
+  index.locate(pred.low(), cursor);
+  if (index.readForward(cursor, first, rid) != 0 || first > pred.high()) {
+    return RC_END_OF_FILE;
+  }
+
+  // there is a key in the range, so the last one is found
+  if ((rc = index.locateLast(pred.high(), last)) != 0) return rc;
+
+  batch.clear();
+  batch.add(first);
+  batch.add(last);
+  return 0;
+}
+
+SnapshotScan::SnapshotScan(const SnapshotFile& snap, const Predicate& pred, bool values)
+  : snap(snap), pred(pred)
+{
+  this->values = values;
+  if (pred.empty()) {
+    pos = last = 0;
+  } else {
+    pos = snap.lowerBound(pred.low());
+    last = (pred.high() == INT_MAX) ? snap.count() : snap.lowerBound(pred.high() + 1);
+  }
+}
+
+RC SnapshotScan::next(RowBatch& batch)
+{
+  const int*  keys = snap.keys();
+  const char* data;
+  int         length;
+
+  batch.clear();
+
+  if (!values && !pred.hasExclusions()) {
+    // every key in the range matches: copy them in bulk
+    int n = last - pos;
+    if (n > batch.room()) n = batch.room();
+    memcpy(batch.end(), keys + pos, n * sizeof(int));
+    batch.grow(n);
+    pos += n;
+  }
+
+  for (; pos < last && !batch.full(); pos++) {
+    if (!pred.notExcluded(keys[pos])) continue;
+    if (values) {
+      snap.value(pos, data, length);
+      batch.add(keys[pos], data, length);
+    } else {
+      batch.add(keys[pos]);
+    }
+  }
+
+  return (batch.count() > 0) ? 0 : RC_END_OF_FILE;
+}
+
+Filter::Filter(Operator* input, const Predicate& pred)
+  : pred(pred)
+{
+  this->input = input;
+}
+
+RC Filter::next(RowBatch& batch)
+{
+  RC          rc;
+  const char* data;
+  int         length;
+
+  while ((rc = input->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    int n = batch.count();
+    int kept = 0;
+    for (int i = 0; i < n; i++) {
+      batch.value(i, data, length);
+      keep[i] = pred.matchValue(keys[i], data, length);
+      kept += keep[i];
+    }
+    if (kept < n) batch.select(keep);
+    if (kept > 0) return 0;
+  }
+
+  return rc;
+}
+
+Count::Count(Operator* input)
+{
+  this->input = input;
+  done = false;
+}
+
+RC Count::next(RowBatch& batch)
+{
+  RC  rc;
+  int total = 0;
+
+  if (done) return RC_END_OF_FILE;
+
+  while ((rc = input->next(batch)) == 0) {
+    total += batch.count();
+  }
+  if (rc != RC_END_OF_FILE) return rc;
+
+  batch.clear();
+  batch.add(total);
+  done = true;
+  return 0;
+}
+
+Sort::Sort(Operator* input, bool descending, int limit)
+{
+  this->input = input;
+  this->descending = descending;
+  this->limit = limit;
+  sorted = false;
+  pos = 0;
+}
+
+bool Sort::Before::operator()(int a, int b) const
+{
+  const Row& x = sort->rows[a];
+  const Row& y = sort->rows[b];
+  if (x.key != y.key) return sort->descending ? x.key > y.key : x.key < y.key;
+  return x.seq < y.seq;
+}
+
+/*
+ * read all rows of the input, keeping the first limit of them, and sort
+ * the rows kept.
+ */
+RC Sort::consume()
+{
+  RC          rc;
+  RowBatch    batch;
+  const char* data;
+  int         length;
+  long long   seq = 0;
+  Before      before = { this };
+
+  while ((rc = input->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    for (int i = 0; i < batch.count(); i++, seq++) {
+      batch.value(i, data, length);
+
+      if (limit < 0 || (int) order.size() < limit) {
+        Row r;
+        r.key = keys[i];
+        r.seq = seq;
+        rows.push_back(r);
+        rows.back().value.assign(data, length);
+        order.push_back(rows.size() - 1);
+        if (limit >= 0) std::push_heap(order.begin(), order.end(), before);
+        continue;
+      }
+
+      // a later row with the same key as the root sorts after it
+      if (limit == 0) continue;
+      const Row& last = rows[order[0]];
+      if (descending ? keys[i] <= last.key : keys[i] >= last.key) continue;
+
+      // the row takes the place of the root
+      std::pop_heap(order.begin(), order.end(), before);
+      Row& r = rows[order.back()];
+      r.key = keys[i];
+      r.seq = seq;
+      r.value.assign(data, length);
+      std::push_heap(order.begin(), order.end(), before);
+    }
+  }
+  if (rc != RC_END_OF_FILE) return rc;
+
+  if (limit >= 0) {
+    std::sort_heap(order.begin(), order.end(), before);
+  } else {
+    std::sort(order.begin(), order.end(), before);
+  }
+  return 0;
+}
+
+RC Sort::next(RowBatch& batch)
+{
+  RC rc;
+
+  if (!sorted) {
+    if ((rc = consume()) < 0) return rc;
+    sorted = true;
+  }
+
+  batch.clear();
+  for (; pos < order.size() && !batch.full(); pos++) {
+    const Row& r = rows[order[pos]];
+    batch.add(r.key, r.value.data(), r.value.size());
+  }
+
+  return (batch.count() > 0) ? 0 : RC_END_OF_FILE;
+}
+
+Limit::Limit(Operator* input, int rows)
+{
+  this->input = input;
+  left = rows;
+}
+
+RC Limit::next(RowBatch& batch)
+{
+  RC rc;
+
+  if (left <= 0) return RC_END_OF_FILE;
+
+  batch.setLimit(left);
+  if ((rc = input->next(batch)) == 0) {
+    left -= batch.count();
+  }
+  return rc;
+}
+
+/*
+ * read a value as a number, like atof.
+ */
+static double toNumber(const char* data, int length)
+{
+  char buf[64];
+
+  if (length < (int) sizeof(buf)) {
+    memcpy(buf, data, length);
+    buf[length] = 0;
+    return atof(buf);
+  }
+  return atof(string(data, length).c_str());
+}
+
+Aggregate::Aggregate(Operator* input, const vector<SelItem>& items, int groupBy,
+                     ResultSink& sink, int limit)
+  : items(items), sink(sink)
+{
+  this->input = input;
+  this->groupBy = groupBy;
+  this->limit = limit;
+}
+
+RC Aggregate::run()
+{
+  RC          rc;
+  RowBatch    batch;
+  const char* data;
+  int         length;
+
+  buckets.assign(INITIAL_BUCKETS, -1);
+
+  // without GROUP BY there is one group, even if there are no rows
+  if (groupBy == 0) {
+    groups.resize(1);
+    groups[0].rows = 0;
+    groups[0].acc.resize(items.size());
+  }
+
+  while ((rc = input->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    for (int i = 0; i < batch.count(); i++) {
+      batch.value(i, data, length);
+      int g = (groupBy == 0) ? 0 : findGroup(keys[i], data, length);
+      update(groups[g], keys[i], data, length);
+    }
+  }
+  if (rc != RC_END_OF_FILE) return rc;
+
+  for (unsigned g = 0; g < groups.size() && (limit < 0 || (int) g < limit); g++) {
+    print(groups[g]);
+  }
+  return 0;
+}
+
+/*
+ * find the group of a row in the hash table, adding it if it is new.
+ * @return the index of the group in groups
+ */
+int Aggregate::findGroup(int key, const char* value, int length)
+{
+  // FNV-1a over the bytes of the key or the value
+  const char* bytes = (groupBy == 1) ? (const char*) &key : value;
+  int         n = (groupBy == 1) ? (int) sizeof(key) : length;
+  unsigned    h = 2166136261u;
+  for (int i = 0; i < n; i++) {
+    h = (h ^ (unsigned char) bytes[i]) * 16777619u;
+  }
+
+  for (int g = buckets[h & (buckets.size() - 1)]; g >= 0; g = groups[g].next) {
+    const Group& grp = groups[g];
+    if (groupBy == 1 ? grp.key == key
+        : (grp.value.size() == (size_t) length && memcmp(grp.value.data(), value, length) == 0)) {
+      return g;
+    }
+  }
+
+  // a new group. the table doubles when there are more groups than buckets
+  groups.resize(groups.size() + 1);
+  Group& grp = groups.back();
+  grp.key = key;
+  grp.hash = h;
+  if (groupBy == 2) grp.value.assign(value, length);
+  grp.rows = 0;
+  grp.acc.resize(items.size());
+
+  int added = groups.size() - 1;
+  if (groups.size() > buckets.size()) {
+    buckets.assign(buckets.size() * 2, -1);
+    for (int g = 0; g <= added; g++) {
+      int b = groups[g].hash & (buckets.size() - 1);
+      groups[g].next = buckets[b];
+      buckets[b] = g;
+    }
+  } else {
+    int b = h & (buckets.size() - 1);
+    grp.next = buckets[b];
+    buckets[b] = added;
+  }
+  return added;
+}
+
+/*
+ * add a row to the aggregates of its group.
+ */
+void Aggregate::update(Group& g, int key, const char* value, int length)
+{
+  for (unsigned i = 0; i < items.size(); i++) {
+    Accumulator& a = g.acc[i];
+    bool         first = (g.rows == 0);
+
+    switch (items[i].func) {
+    case SelItem::MIN:
+      if (items[i].attr == 1) {
+        if (first || key < a.minKey) a.minKey = key;
+      } else if (first || Predicate::compareValue(value, length, a.minValue.data(), a.minValue.size()) < 0) {
+        a.minValue.assign(value, length);
+      }
+      break;
+    case SelItem::MAX:
+      if (items[i].attr == 1) {
+        if (first || key > a.maxKey) a.maxKey = key;
+      } else if (first || Predicate::compareValue(value, length, a.maxValue.data(), a.maxValue.size()) > 0) {
+        a.maxValue.assign(value, length);
+      }
+      break;
+    case SelItem::SUM:
+    case SelItem::AVG:
+      if (items[i].attr == 1) {
+        a.sum += key;
+      } else {
+        a.total += toNumber(value, length);
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  g.rows++;
+}
+
+/*
+ * print the aggregates of a group as a row.
+ */
+void Aggregate::print(const Group& g) const
+{
+  sink.beginRow(items.size());
+
+  for (unsigned i = 0; i < items.size(); i++) {
+    const Accumulator& a = g.acc[i];
+    int                attr = items[i].attr;
+
+    if (items[i].func == SelItem::NONE) {
+      if (attr == 1) sink.addInt(g.key);
+      else sink.addString(g.value.data(), g.value.size());
+      continue;
+    }
+    if (items[i].func == SelItem::COUNT) {
+      sink.addInt(g.rows);
+      continue;
+    }
+    if (g.rows == 0) {
+      sink.addNull();
+      continue;
+    }
+
+    switch (items[i].func) {
+    case SelItem::MIN:
+      if (attr == 1) sink.addInt(a.minKey);
+      else sink.addString(a.minValue.data(), a.minValue.size());
+      break;
+    case SelItem::MAX:
+      if (attr == 1) sink.addInt(a.maxKey);
+      else sink.addString(a.maxValue.data(), a.maxValue.size());
+      break;
+    case SelItem::SUM:
+      if (attr == 1) sink.addInt(a.sum);
+      else sink.addNumber(a.total);
+      break;
+    case SelItem::AVG:
+      sink.addNumber(((attr == 1) ? (double) a.sum : a.total) / g.rows);
+      break;
+    default:
+      break;
+    }
+  }
+  sink.endRow();
+}
+
+const int JoinOutput::KEY;
+const int JoinOutput::LEFT_VALUE;
+const int JoinOutput::RIGHT_VALUE;
+
+JoinOutput::JoinOutput(const vector<int>& columns, ResultSink& sink, int limit)
+  : columns(columns), sink(sink)
+{
+  this->limit = limit;
+  rows = 0;
+}
+
+void JoinOutput::add(int key, const char* left, int leftLength, const char* right, int rightLength)
+{
+  if (full()) return;
+  rows++;
+  if (columns.empty()) return;
+
+  sink.beginRow(columns.size());
+  for (unsigned i = 0; i < columns.size(); i++) {
+    switch (columns[i]) {
+    case KEY:
+      sink.addInt(key);
+      break;
+    case LEFT_VALUE:
+      sink.addString(left, leftLength);
+      break;
+    case RIGHT_VALUE:
+      sink.addString(right, rightLength);
+      break;
+    }
+  }
+  sink.endRow();
+}
+
+void JoinOutput::finish()
+{
+  if (columns.empty() && limit != 0) {
+    sink.beginRow(1);
+    sink.addInt(rows);
+    sink.endRow();
+  }
+}
+
+void Join::add(JoinOutput& out, bool sideIsLeft, int key,
+               const char* side, int sideLength, const char* other, int otherLength)
+{
+  if (sideIsLeft) {
+    out.add(key, side, sideLength, other, otherLength);
+  } else {
+    out.add(key, other, otherLength, side, sideLength);
+  }
+}
+
+/*
+ * spread the keys over the buckets of a hash table, also when they are
+ * multiples of a power of two.
+ */
+static unsigned hashKey(int key)
+{
+  unsigned h = (unsigned) key * 2654435761u;
+  return h ^ (h >> 16);
+}
+
+HashJoin::HashJoin(Operator* build, Operator* probe, bool buildIsLeft)
+{
+  this->build = build;
+  this->probe = probe;
+  this->buildIsLeft = buildIsLeft;
+}
+
+RC HashJoin::run(JoinOutput& out)
+{
+  RC          rc = 0;
+  RowBatch    batch;
+  const char* data;
+  int         length;
+
+  if (out.full()) return 0;
+
+  // keep the rows of the build side
+  while ((rc = build->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    for (int i = 0; i < batch.count(); i++) {
+      Entry e;
+      batch.value(i, data, length);
+      e.key = keys[i];
+      e.offset = heap.size();
+      e.length = length;
+      if (length > 0) heap.append(data, length);
+      entries.push_back(e);
+    }
+  }
+  if (rc != RC_END_OF_FILE) return rc;
+
+  // nothing can match, so the probe side is not read
+  if (entries.empty()) return 0;
+
+  // at least a bucket per entry
+  unsigned size = 1;
+  while (size < entries.size()) size *= 2;
+  buckets.assign(size, -1);
+  for (unsigned i = 0; i < entries.size(); i++) {
+    unsigned b = hashKey(entries[i].key) & (size - 1);
+    entries[i].next = buckets[b];
+    buckets[b] = i;
+  }
+
+  while (!out.full() && (rc = probe->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    for (int i = 0; i < batch.count() && !out.full(); i++) {
+      batch.value(i, data, length);
+      for (int j = buckets[hashKey(keys[i]) & (size - 1)]; j >= 0; j = entries[j].next) {
+        if (entries[j].key != keys[i]) continue;
+        add(out, buildIsLeft, keys[i], heap.data() + entries[j].offset, entries[j].length,
+            data, length);
+      }
+    }
+  }
+
+  return (rc == RC_END_OF_FILE || out.full()) ? 0 : rc;
+}
+
+// orders the rows of a batch by key
+struct ByKey {
+  const int* keys;
+  bool operator()(int a, int b) const { return keys[a] < keys[b]; }
+};
+
+IndexNestedLoopJoin::IndexNestedLoopJoin(Operator* outer, BTreeIndex& index,
+                                         const RecordFile& rf, const Predicate& innerPred,
+                                         bool innerValues, bool outerIsLeft)
+  : index(index), rf(rf), innerPred(innerPred)
+{
+  this->outer = outer;
+  this->innerValues = innerValues;
+  this->outerIsLeft = outerIsLeft;
+}
+
+RC IndexNestedLoopJoin::run(JoinOutput& out)
+{
+  RC          rc = 0;  // 0 if out is full before a row is read
+  RowBatch    batch;
+  const char* data;
+  int         length;
+  const char* value = NULL;   // the value of the inner row
+  int         valueLength = 0;
+  string      covered;
+  vector<int> order;
+  ByKey       byKey;
+  RecordFile::ReadBuffer record;
+
+  while (!out.full() && (rc = outer->next(batch)) == 0) {
+    int n = batch.count();
+
+    byKey.keys = batch.keys();
+    order.resize(n);
+    for (int i = 0; i < n; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), byKey);
+
+    for (int j = 0; j < n && !out.full(); j++) {
+      int key = byKey.keys[order[j]];
+      if (!innerPred.matchKey(key) || !index.mayContain(key)) continue;
+      batch.value(order[j], data, length);
+
+      IndexCursor cursor;
+      int         innerKey;
+      RecordId    rid;
+
+      index.locate(key, cursor);
+      for (;;) {
+        if (innerValues && index.isCovering()) {
+          rc = index.readForward(cursor, innerKey, rid, covered);
+          value = covered.data();
+          valueLength = covered.size();
+        } else {
+          rc = index.readForward(cursor, innerKey, rid);
+        }
+        if (rc != 0 || innerKey > key) break;
+        if (innerKey < key) continue;
+
+        if (innerValues && !index.isCovering()) {
+          // the record is read into a buffer that the next read reuses
+          if ((rc = rf.read(rid, innerKey, value, valueLength, record)) < 0) return rc;
+        }
+        if (innerPred.needsValue() && !innerPred.matchValue(key, value, valueLength)) continue;
+        add(out, outerIsLeft, key, data, length, value, valueLength);
+      }
+    }
+  }
+
+  return (rc == RC_END_OF_FILE || out.full()) ? 0 : rc;
+}
+
+MergeJoin::MergeJoin(Operator* left, Operator* right)
+{
+  this->left.input = left;
+  this->right.input = right;
+}
+
+/*
+ * move to the next row of a side, reading the next batch when the rows
+ * of the current one are used up.
+ * @return 0, RC_END_OF_FILE after the last row, or another error code
+ */
+RC MergeJoin::advance(Side& s)
+{
+  if (++s.pos < s.batch.count()) return 0;
+  s.pos = 0;
+  return s.input->next(s.batch);
+}
+
+RC MergeJoin::run(JoinOutput& out)
+{
+  RC             lrc, rrc;
+  const char*    data;
+  int            length;
+  vector<string> values;   // the values of the right rows with the current key
+
+  if (out.full()) return 0;
+
+  left.pos = right.pos = -1;
+  lrc = advance(left);
+  rrc = advance(right);
+
+  while (lrc == 0 && rrc == 0 && !out.full()) {
+    int key = left.batch.keys()[left.pos];
+    int rightKey = right.batch.keys()[right.pos];
+    if (key < rightKey) {
+      lrc = advance(left);
+      continue;
+    }
+    if (key > rightKey) {
+      rrc = advance(right);
+      continue;
+    }
+
+    values.clear();
+    do {
+      right.batch.value(right.pos, data, length);
+      values.push_back((length > 0) ? string(data, length) : string());
+      rrc = advance(right);
+    } while (rrc == 0 && right.batch.keys()[right.pos] == key);
+
+    do {
+      left.batch.value(left.pos, data, length);
+      for (unsigned j = 0; j < values.size(); j++) {
+        out.add(key, data, length, values[j].data(), values[j].size());
+      }
+      lrc = advance(left);
+    } while (lrc == 0 && left.batch.keys()[left.pos] == key);
+  }
+
+  if (lrc != 0 && lrc != RC_END_OF_FILE) return lrc;
+  if (rrc != 0 && rrc != RC_END_OF_FILE) return rrc;
+  return 0;
+}
+
+Output::Output(Operator* input, int columns, ResultSink& sink)
+  : sink(sink)
+{
+  this->input = input;
+  this->columns = columns;
+}
+
+RC Output::run()
+{
+  RC          rc;
+  RowBatch    batch;
+  const char* data;
+  int         length;
+
+  while ((rc = input->next(batch)) == 0) {
+    const int* keys = batch.keys();
+    for (int i = 0; i < batch.count(); i++) {
+      batch.value(i, data, length);
+      switch (columns) {
+      case KEY:
+        sink.beginRow(1);
+        sink.addInt(keys[i]);
+        break;
+      case VALUE:
+        sink.beginRow(1);
+        sink.addString(data, length);
+        break;
+      case BOTH:
+        sink.beginRow(2);
+        sink.addInt(keys[i]);
+        sink.addString(data, length);
+        break;
+      }
+      sink.endRow();
+    }
+  }
+
+  return (rc == RC_END_OF_FILE) ? 0 : rc;
+}
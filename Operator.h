@@ -0,0 +1,759 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef OPERATOR_H
+#define OPERATOR_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "Bruinbase.h"
+#include "RecordFile.h"
+#include "BTreeIndex.h"
+#include "SnapshotFile.h"
+#include "Predicate.h"
+#include "ResultSink.h"
+
+/**
+ * A batch of up to CAPACITY rows passed from one operator to the next.
+ * The keys are kept in one array and the values as (pointer, length)
+ * views. A view points into a page or file that the producing operator
+ * keeps in place until its next call of next(), or to a copy owned by
+ * the batch.
+ */
+class RowBatch {
+ public:
+  static const int CAPACITY = 1024;
+
+  RowBatch();
+
+  /**
+   * remove all rows.
+   */
+  void clear() { n = 0; owned.clear(); }
+
+  /**
+   * @return # rows in the batch
+   */
+  int count() const { return n; }
+
+  /**
+   * @return true if no more row fits in the batch
+   */
+  bool full() const { return n >= limit; }
+
+  /**
+   * @return # rows that still fit in the batch
+   */
+  int room() const { return limit - n; }
+
+  /**
+   * let producers fill the batch with fewer than CAPACITY rows, for a
+   * consumer that needs only a few more rows.
+   * @param rows[IN] # rows at most, up to CAPACITY
+   */
+  void setLimit(int rows) { limit = (rows < CAPACITY) ? rows : CAPACITY; }
+
+  /**
+   * @return the keys of the rows
+   */
+  const int* keys() const { return keyArray; }
+
+  /**
+   * @return room for room() keys after the last row, for producers that
+   * write keys in bulk and then call grow()
+   */
+  int* end() { return keyArray + n; }
+
+  /**
+   * take the keys written at end() as rows without values.
+   * @param added[IN] # keys written
+   */
+  void grow(int added);
+
+  /**
+   * add a row without a value.
+   * @param key[IN] the key of the row
+   */
+  void add(int key) { keyArray[n] = key; data[n] = NULL; length[n] = 0; n++; }
+
+  /**
+   * add a row whose value stays where it is.
+   * @param key[IN] the key of the row
+   * @param value[IN] the value, valid until the producer is called again
+   * @param len[IN] # bytes in the value
+   */
+  void add(int key, const char* value, int len) { keyArray[n] = key; data[n] = value; length[n] = len; n++; }
+
+  /**
+   * add a row with a copy of its value.
+   * @param key[IN] the key of the row
+   * @param value[IN] the value
+   * @param len[IN] # bytes in the value
+   */
+  void addCopy(int key, const char* value, int len);
+
+  /**
+   * get the value of a row.
+   * @param i[IN] the row
+   * @param bytes[OUT] the value bytes
+   * @param len[OUT] # bytes in the value
+   */
+  void value(int i, const char*& bytes, int& len) const { bytes = data[i]; len = length[i]; }
+
+  /**
+   * keep only the rows for which keep[i] is nonzero, in their order.
+   * @param keep[IN] one flag per row
+   */
+  void select(const char* keep);
+
+ private:
+  int         n;
+  int         limit;   // # rows that fit in the batch
+  int         keyArray[CAPACITY];
+  const char* data[CAPACITY];
+  int         length[CAPACITY];
+  std::vector<std::string> owned;  // the copied values. never reallocated
+};
+
+/**
+ * An operator of a query plan. Operators are chained: each one pulls
+ * batches from its input with next() and hands its own result batches
+ * to the operator above it.
+ */
+class Operator {
+ public:
+  virtual ~Operator() { }
+
+  /**
+   * produce the next batch of rows.
+   * @param batch[OUT] at least one row if 0 is returned
+   * @return 0 if a batch is produced, RC_END_OF_FILE when there are no more
+   * rows, or another error code
+   */
+  virtual RC next(RowBatch& batch) = 0;
+};
+
+/**
+ * Reads the rows of a table a page at a time, skipping the pages that the
+ * zone map rules out, and returns those whose key satisfies the key
+ * conditions of a Predicate. The keys are filtered with vector compares
+ * where available.
+ */
+class TableScan : public Operator {
+ public:
+  /**
+   * @param rf[IN] the open table
+   * @param pred[IN] the conditions. only the key conditions are applied
+   * @param values[IN] true if the rows need their values
+   */
+  TableScan(const RecordFile& rf, const Predicate& pred, bool values);
+  RC next(RowBatch& batch);
+
+ private:
+  RecordFile::Scanner scan;
+  const Predicate&    pred;
+  bool                values;
+  int                 pos;   // the next record of the loaded page
+};
+
+/**
+ * A scan run by worker threads. The scan is cut into morsels, and every
+ * idle worker takes the next morsel that no other worker has taken, so a
+ * worker that is slowed down by selective pages or long values simply
+ * takes fewer morsels. A worker applies all conditions of the Predicate,
+ * the value conditions included, and keeps the matching rows of its
+ * morsel. next() returns the morsels in order, so the rows come out in
+ * the order of the serial scan. The workers stay at most AHEAD_MORSELS
+ * morsels per worker ahead of the morsel being returned.
+ * A subclass fills morsels and calls start() in its constructor, and
+ * calls finish() in its destructor.
+ */
+class ParallelScan : public Operator {
+ public:
+  static const int MAX_WORKERS = 64;
+  static const int AHEAD_MORSELS = 4;   // morsels per worker scanned ahead
+
+  virtual ~ParallelScan();
+
+  RC next(RowBatch& batch);
+
+  /**
+   * @param pages[IN] # pages the scan reads
+   * @return # worker threads worth starting for the scan: one per core,
+   * but no more than one per MORSEL_PAGES pages. 1 if a serial scan is better
+   */
+  static int workersFor(int pages);
+
+ protected:
+  static const int MORSEL_PAGES = 64;   // pages worth a worker of their own
+
+  // a share of the scan and the rows of it that match
+  struct Morsel {
+    int              first, last;  // the pages or keys of the morsel
+    bool             done;         // scanned by a worker
+    RC               rc;           // the error of the worker. 0 if none
+    std::vector<int> keys;
+    std::vector<int> offsets;      // where the value of a row starts in heap
+    std::string      heap;         // the values of the rows back to back
+  };
+
+  ParallelScan(const Predicate& pred, bool values);
+
+  /**
+   * add a morsel. all morsels are added before start().
+   */
+  void addMorsel(int first, int last);
+
+  /**
+   * keep a row of a morsel.
+   * @param value[IN] the value. ignored if the rows need no values
+   * @param length[IN] # bytes in the value
+   */
+  void keep(Morsel& m, int key, const char* value, int length);
+
+  /**
+   * start the workers.
+   * @param workers[IN] # worker threads
+   */
+  void start(int workers);
+
+  /**
+   * stop and join the workers.
+   */
+  void finish();
+
+  /**
+   * scan a morsel, keeping the rows that satisfy all conditions.
+   * it runs in a worker thread, next to other calls for other morsels.
+   * @return error code. 0 if no error
+   */
+  virtual RC scanMorsel(Morsel& m) = 0;
+
+  const Predicate& pred;
+  bool             values;
+
+ private:
+  static void* work(void* arg);
+  void run();
+
+  std::vector<Morsel>    morsels;
+  std::vector<pthread_t> threads;
+  int                    ahead;     // # morsels the workers may scan ahead
+
+  // guarded by lock
+  pthread_mutex_t lock;
+  pthread_cond_t  scanned;   // signaled when a morsel is done
+  pthread_cond_t  advanced;  // signaled when next() moves to a new morsel
+  int             taken;     // # morsels taken by workers
+  int             current;   // the morsel next() returns rows from
+  bool            stop;      // the workers must quit
+
+  int             released;  // the morsels before this one are freed
+  int             pos;       // the next row of the current morsel
+};
+
+/**
+ * A TableScan run by worker threads, MORSEL_PAGES pages per morsel.
+ */
+class ParallelTableScan : public ParallelScan {
+ public:
+  /**
+   * start the workers.
+   * @param rf[IN] the open table
+   * @param pred[IN] the conditions. all of them are applied
+   * @param values[IN] true if the rows need their values
+   * @param workers[IN] # worker threads
+   */
+  ParallelTableScan(const RecordFile& rf, const Predicate& pred, bool values, int workers);
+  ~ParallelTableScan();
+
+ protected:
+  RC scanMorsel(Morsel& m);
+
+ private:
+  const RecordFile& rf;
+};
+
+/**
+ * Reads the index entries with a key in the range of a Predicate in key
+ * order. With OR, the cursor is moved past the gaps between the ranges
+ * with a new descent. The values come from a covering index, or from the table: then
+ * the entries are collected FETCH_BATCH_SIZE at a time and their records
+ * read in page order, so that every table page is read once per batch.
+ * A clustered table is also read a few pages ahead. A scan in key order
+ * reads every record as soon as its entry is read instead, so that the
+ * rows come out in key order and no entry is read before it is needed.
+ */
+class IndexRangeScan : public Operator {
+ public:
+  static const int FETCH_BATCH_SIZE = 4096; // entries whose records are read at once
+  static const int READ_AHEAD_PAGES = 4;    // pages of a clustered table read at once
+
+  // where the values come from
+  enum Mode { KEYS_ONLY, COVERING, FETCH };
+
+  // an index entry whose record still has to be read
+  struct Entry {
+    int      key;
+    RecordId rid;
+  };
+
+  static bool ridLess(const Entry& a, const Entry& b);
+
+  /**
+   * @param index[IN] the open index of the table
+   * @param rf[IN] the open table
+   * @param pred[IN] the conditions. only the key conditions are applied
+   * @param mode[IN] KEYS_ONLY, COVERING or FETCH
+   * @param keyOrder[IN] true to return the rows in key order also in
+   * FETCH mode
+   */
+  IndexRangeScan(BTreeIndex& index, const RecordFile& rf, const Predicate& pred, Mode mode,
+                 bool keyOrder = false);
+  RC next(RowBatch& batch);
+
+ private:
+  RC readEntry(int& key, RecordId& rid);
+  RC collect();
+
+  BTreeIndex&       index;
+  const RecordFile& rf;
+  const Predicate&  pred;
+  Mode              mode;
+  bool              keyOrder;
+  IndexCursor       cursor;
+  bool              started;  // the cursor is located
+  bool              done;     // the last entry in the range is read
+  int               range;    // the key range of the Predicate being read
+  std::string       value;    // the value read from a covering index
+  RecordFile::ReadBuffer record; // the record read from the table
+
+  std::vector<Entry> pending; // the entries to read in page order
+  unsigned           pos;     // the next entry in pending
+  bool               readAhead;
+  PageId             fetched; // the pages up to here have been read ahead
+};
+
+/**
+ * An IndexRangeScan run by worker threads. The key range is split at the
+ * separator keys of the non-leaf nodes of the index into a few sub-ranges
+ * per worker, and every sub-range is a morsel read with a
+ * BTreeIndex::LeafScanner of its own, so the workers do not share the
+ * page cache. The records of a sub-range are read in page order,
+ * IndexRangeScan::FETCH_BATCH_SIZE at a time, by the worker that reads
+ * its index entries.
+ */
+class ParallelIndexScan : public ParallelScan {
+ public:
+  /**
+   * start the workers.
+   * @param index[IN] the open index of the table
+   * @param rf[IN] the open table
+   * @param pred[IN] the conditions. all of them are applied
+   * @param mode[IN] where the values come from
+   * @param workers[IN] # worker threads
+   */
+  ParallelIndexScan(BTreeIndex& index, const RecordFile& rf, const Predicate& pred,
+                    IndexRangeScan::Mode mode, int workers);
+  ~ParallelIndexScan();
+
+ protected:
+  RC scanMorsel(Morsel& m);
+
+ private:
+  RC fetch(std::vector<IndexRangeScan::Entry>& entries, Morsel& m);
+
+  BTreeIndex&          index;
+  const RecordFile&    rf;
+  IndexRangeScan::Mode mode;
+};
+
+/**
+ * Returns the smallest and the largest key of an index in the range of a
+ * Predicate, found with one descent each, and none of the keys between.
+ * This answers MIN and MAX of the key without reading the range.
+ * The Predicate must be a single range without <> conditions.
+ */
+class KeyBoundsScan : public Operator {
+ public:
+  /**
+   * @param index[IN] the open index of the table
+   * @param pred[IN] the conditions. only the key range is applied
+   */
+  KeyBoundsScan(BTreeIndex& index, const Predicate& pred);
+  RC next(RowBatch& batch);
+
+ private:
+  BTreeIndex&      index;
+  const Predicate& pred;
+  bool             done;
+};
+
+/**
+ * Returns the rows of a table snapshot with a key in the range of a
+ * Predicate, found by a binary search. The values are views of the
+ * mapped file.
+ */
+class SnapshotScan : public Operator {
+ public:
+  /**
+   * @param snap[IN] the open snapshot
+   * @param pred[IN] the conditions. only the key conditions are applied
+   * @param values[IN] true if the rows need their values
+   */
+  SnapshotScan(const SnapshotFile& snap, const Predicate& pred, bool values);
+  RC next(RowBatch& batch);
+
+ private:
+  const SnapshotFile& snap;
+  const Predicate&    pred;
+  bool                values;
+  int                 pos;   // the next row
+  int                 last;  // the row after the last one in the range
+};
+
+/**
+ * Keeps the rows whose value satisfies the value conditions of a
+ * Predicate. The key conditions are left to the scan below.
+ */
+class Filter : public Operator {
+ public:
+  Filter(Operator* input, const Predicate& pred);
+  RC next(RowBatch& batch);
+
+ private:
+  Operator*        input;
+  const Predicate& pred;
+  char             keep[RowBatch::CAPACITY];
+};
+
+/**
+ * Counts the rows of its input and returns one row whose key is the count.
+ */
+class Count : public Operator {
+ public:
+  Count(Operator* input);
+  RC next(RowBatch& batch);
+
+ private:
+  Operator* input;
+  bool      done;
+};
+
+/**
+ * Returns the rows of its input ordered by key, the rows with the same key
+ * in their input order. With a limit only the first rows are kept, in a
+ * heap whose root is the last of them: a row that sorts after the root is
+ * dropped at once, so the work and the memory are bounded by the limit
+ * rather than by the input.
+ */
+class Sort : public Operator {
+ public:
+  /**
+   * @param input[IN] the rows to sort
+   * @param descending[IN] true to return the largest keys first
+   * @param limit[IN] # rows to return at most. -1 for all rows
+   */
+  Sort(Operator* input, bool descending, int limit);
+  RC next(RowBatch& batch);
+
+ private:
+  // a row kept, and its position in the input
+  struct Row {
+    int         key;
+    long long   seq;
+    std::string value;
+  };
+
+  // orders the kept rows by their position in the output
+  struct Before {
+    const Sort* sort;
+    bool operator()(int a, int b) const;
+  };
+
+  RC consume();
+
+  Operator*        input;
+  bool             descending;
+  int              limit;
+  bool             sorted;  // the input has been read and sorted
+  std::vector<Row> rows;
+  std::vector<int> order;   // the rows kept, a heap until sorted
+  unsigned         pos;     // the next row of order to return
+};
+
+/**
+ * Returns the first rows of its input, and then stops. The batches it
+ * asks for hold no more rows than are still needed, so a scan below
+ * reads no further than the rows that are returned.
+ */
+class Limit : public Operator {
+ public:
+  /**
+   * @param input[IN] the rows
+   * @param rows[IN] # rows to return at most
+   */
+  Limit(Operator* input, int rows);
+  RC next(RowBatch& batch);
+
+ private:
+  Operator* input;
+  int       left;   // # rows still to return
+};
+
+/**
+ * Computes the aggregates of a SELECT list over the rows of its input and
+ * prints them: one row for all input rows, or with GROUP BY one row per
+ * distinct key or value. The groups are kept in a hash table, and printed
+ * in the order of their first rows. SUM and AVG of the value read every
+ * value as a number, like atof. The aggregates of no rows are NULL,
+ * except COUNT(*).
+ */
+class Aggregate {
+ public:
+  /**
+   * @param input[IN] the operator whose rows are aggregated
+   * @param items[IN] the aggregates and grouping attributes to print
+   * @param groupBy[IN] the attribute the rows are grouped by
+   * (1: key, 2: value, 0: all rows form a single group)
+   * @param sink[IN] receives a row per group
+   * @param limit[IN] # groups to print at most. -1 for all groups
+   */
+  Aggregate(Operator* input, const std::vector<SelItem>& items, int groupBy,
+            ResultSink& sink, int limit = -1);
+
+  /**
+   * aggregate all rows of the input and print the result.
+   * @return error code. 0 if no error
+   */
+  RC run();
+
+ private:
+  static const int INITIAL_BUCKETS = 1024;
+
+  // the running aggregate of an item over the rows of a group
+  struct Accumulator {
+    Accumulator() : sum(0), total(0), minKey(0), maxKey(0) { }
+
+    long long   sum;       // of the keys
+    double      total;     // of the values read as numbers
+    int         minKey;
+    int         maxKey;
+    std::string minValue;
+    std::string maxValue;
+  };
+
+  // the rows that share a key or value
+  struct Group {
+    int         key;       // the grouping key, or value
+    std::string value;
+    long long   rows;
+    unsigned    hash;      // of the key or value
+    int         next;      // the next group in the hash bucket. -1 if none
+    std::vector<Accumulator> acc;  // one per item
+  };
+
+  int  findGroup(int key, const char* value, int length);
+  void update(Group& g, int key, const char* value, int length);
+  void print(const Group& g) const;
+
+  Operator*                   input;
+  const std::vector<SelItem>& items;
+  int                         groupBy;
+  ResultSink&                 sink;
+  int                         limit;    // # groups printed at most. -1 for all
+  std::vector<Group>          groups;   // in the order of their first rows
+  std::vector<int>            buckets;  // the first group of every bucket. -1 if none
+};
+
+/**
+ * Prints the rows of a join of two tables on their keys, or counts them.
+ */
+class JoinOutput {
+ public:
+  static const int KEY = 0;          // the key the rows are joined on
+  static const int LEFT_VALUE = 1;   // the value of the first table in FROM
+  static const int RIGHT_VALUE = 2;  // the value of the second table
+
+  /**
+   * @param columns[IN] the columns to print, KEY, LEFT_VALUE or
+   * RIGHT_VALUE. empty to print the # rows instead
+   * @param sink[IN] receives the rows
+   * @param limit[IN] # lines to print at most. -1 for no limit
+   */
+  JoinOutput(const std::vector<int>& columns, ResultSink& sink, int limit = -1);
+
+  /**
+   * print a joined row, or count it. a row past the limit is dropped.
+   */
+  void add(int key, const char* left, int leftLength, const char* right, int rightLength);
+
+  /**
+   * @return true if no more rows are printed, so a join can stop
+   */
+  bool full() const { return limit == 0 || (limit > 0 && !columns.empty() && rows >= limit); }
+
+  /**
+   * print the # rows if they are counted.
+   */
+  void finish();
+
+ private:
+  std::vector<int> columns;
+  ResultSink&      sink;
+  int              limit;
+  long long        rows;   // printed or counted
+};
+
+/**
+ * A join of two tables on their keys. Every strategy reads the rows of
+ * the first and the second table in FROM, the left and the right side,
+ * from operators that have applied the conditions of their table, and
+ * hands the pairs of rows with the same key to a JoinOutput.
+ */
+class Join {
+ public:
+  virtual ~Join() { }
+
+  /**
+   * join all rows.
+   * @param out[IN] receives the joined rows
+   * @return error code. 0 if no error
+   */
+  virtual RC run(JoinOutput& out) = 0;
+
+ protected:
+  // add a row of the build or outer side and a row of the other side
+  // to out, the left one first
+  static void add(JoinOutput& out, bool sideIsLeft, int key,
+                  const char* side, int sideLength, const char* other, int otherLength);
+};
+
+/**
+ * Reads all rows of one side into a hash table on the key, and then
+ * looks up every row of the other side in it. Neither table needs an
+ * index, and each is read once. The smaller side is the one kept.
+ */
+class HashJoin : public Join {
+ public:
+  /**
+   * @param build[IN] the rows kept in the hash table
+   * @param probe[IN] the rows looked up
+   * @param buildIsLeft[IN] true if build reads the first table in FROM
+   */
+  HashJoin(Operator* build, Operator* probe, bool buildIsLeft);
+  RC run(JoinOutput& out);
+
+ private:
+  // a row in the hash table
+  struct Entry {
+    int key;
+    int next;      // the next entry in the bucket. -1 if none
+    int offset;    // where the value starts in heap
+    int length;
+  };
+
+  Operator*          build;
+  Operator*          probe;
+  bool               buildIsLeft;
+  std::vector<Entry> entries;
+  std::vector<int>   buckets;   // the first entry of every bucket. -1 if none
+  std::string        heap;      // the values of the entries back to back
+};
+
+/**
+ * Looks up the key of every row of the outer side in the index of the
+ * inner table, and reads the matching entries, with their values from a
+ * covering index or from the table if the values are needed. The keys
+ * of a batch are looked up in key order, so that consecutive lookups
+ * find their index nodes in the page cache, and a key that the Bloom
+ * filter of the index has never seen is not looked up. Only the pages
+ * of the matches of the inner table are read.
+ */
+class IndexNestedLoopJoin : public Join {
+ public:
+  /**
+   * @param outer[IN] the rows whose keys are looked up
+   * @param index[IN] the open index of the inner table
+   * @param rf[IN] the open inner table
+   * @param innerPred[IN] the conditions on the inner table
+   * @param innerValues[IN] true if the values of the inner rows are needed
+   * @param outerIsLeft[IN] true if outer reads the first table in FROM
+   */
+  IndexNestedLoopJoin(Operator* outer, BTreeIndex& index, const RecordFile& rf,
+                      const Predicate& innerPred, bool innerValues, bool outerIsLeft);
+  RC run(JoinOutput& out);
+
+ private:
+  Operator*         outer;
+  BTreeIndex&       index;
+  const RecordFile& rf;
+  const Predicate&  innerPred;
+  bool              innerValues;
+  bool              outerIsLeft;
+};
+
+/**
+ * Joins two sides that return their rows in key order, such as index
+ * range scans of both tables, by walking them in lockstep. The rows of
+ * the right side with the key of the current left row are kept until
+ * the left side moves past the key.
+ */
+class MergeJoin : public Join {
+ public:
+  /**
+   * @param left[IN] the rows of the first table in FROM, in key order
+   * @param right[IN] the rows of the second table, in key order
+   */
+  MergeJoin(Operator* left, Operator* right);
+  RC run(JoinOutput& out);
+
+ private:
+  // the rows of a side and the next one to join
+  struct Side {
+    Operator* input;
+    RowBatch  batch;
+    int       pos;
+  };
+
+  static RC advance(Side& s);
+
+  Side left;
+  Side right;
+};
+
+/**
+ * Prints the rows of its input through a ResultSink: the key, the value
+ * or both.
+ * This is where the SELECT list is projected.
+ */
+class Output {
+ public:
+  static const int KEY = 1;
+  static const int VALUE = 2;
+  static const int BOTH = 3;
+
+  /**
+   * @param input[IN] the operator whose rows are printed
+   * @param columns[IN] KEY, VALUE or BOTH
+   * @param sink[IN] receives the rows
+   */
+  Output(Operator* input, int columns, ResultSink& sink);
+
+  /**
+   * print all rows of the input.
+   * @return error code. 0 if no error
+   */
+  RC run();
+
+ private:
+  Operator*   input;
+  int         columns;
+  ResultSink& sink;
+};
+
+#endif // OPERATOR_H
@@ -13,6 +13,7 @@
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <pthread.h>
 
 using std::string;
 
@@ -21,6 +22,16 @@ int PageFile::writeCount = 0;
 int PageFile::cacheClock = 1;
 struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
 
+// guards the read cache and the page counters, which all threads share
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// holds the cache lock while in scope
+class CacheLock {
+ public:
+  CacheLock()  { pthread_mutex_lock(&cacheMutex); }
+  ~CacheLock() { pthread_mutex_unlock(&cacheMutex); }
+};
+
 PageFile::PageFile() 
 { 
   fd = -1; 
@@ -70,6 +81,8 @@ RC PageFile::open(const string& filename, char mode)
 
 RC PageFile::close()
 {
+  CacheLock lock;
+
   if (fd <= 0) return RC_FILE_CLOSE_FAILED;
 
   // close the file
@@ -102,6 +115,7 @@ RC PageFile::seek(PageId pid) const
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
+  CacheLock lock;
   RC rc;
   if (pid < 0) return RC_INVALID_PID; 
 
@@ -131,8 +145,41 @@ RC PageFile::write(PageId pid, const void* buffer)
   return 0;
 }
 
+RC PageFile::write(PageId pid, const void* buffer, int count)
+{
+  CacheLock lock;
+  RC rc;
+  if (pid < 0 || count < 0) return RC_INVALID_PID;
+  if (count == 0) return 0;
+
+  // seek to the location of the first page
+  if ((rc = seek(pid)) < 0) return rc;
+
+  // write all pages at once
+  if (::write(fd, buffer, count * PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+
+  // invalidate the written pages in the read cache
+  for (int i = 0; i < CACHE_COUNT; i++) {
+    if (readCache[i].fd == fd && readCache[i].pid >= pid &&
+        readCache[i].pid < pid + count && readCache[i].lastAccessed != 0) {
+       readCache[i].fd = 0;
+       readCache[i].pid = 0;
+       readCache[i].lastAccessed = 0;
+    }
+  }
+
+  // if the written pages go past the end pid, update the end pid
+  if (pid + count > epid) epid = pid + count;
+
+  // increase page write count
+  writeCount += count;
+
+  return 0;
+}
+
 RC PageFile::read(PageId pid, void* buffer) const
 {
+  CacheLock lock;
   RC rc;
 
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
@@ -145,6 +192,7 @@ RC PageFile::read(PageId pid, void* buffer) const
         readCache[i].lastAccessed != 0) {
        memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
        readCache[i].lastAccessed = ++cacheClock;
+       readCache[i].ahead = false;
        return 0;
     }
   }
@@ -153,19 +201,11 @@ RC PageFile::read(PageId pid, void* buffer) const
   if ((rc = seek(pid)) < 0) return rc;
   
   // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
-    }
-  }
+  int toEvict = evictSlot();
   readCache[toEvict].fd = fd;
   readCache[toEvict].pid = pid;
   readCache[toEvict].lastAccessed = ++cacheClock;
+  readCache[toEvict].ahead = false;
  
   // read the page to cache first and copy it to the buffer
   if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
@@ -178,3 +218,95 @@ RC PageFile::read(PageId pid, void* buffer) const
 
   return 0;
 }
+
+RC PageFile::prefetch(PageId pid, int count) const
+{
+  CacheLock lock;
+  RC rc;
+
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+  if (count > CACHE_COUNT / 2) count = CACHE_COUNT / 2;
+  if (pid + count > epid) count = epid - pid;
+
+  // pages at the front that are already cached need not be read again
+  while (count > 0) {
+    int i;
+    for (i = 0; i < CACHE_COUNT; i++) {
+      if (readCache[i].fd == fd && readCache[i].pid == pid &&
+          readCache[i].lastAccessed != 0) break;
+    }
+    if (i == CACHE_COUNT) break;
+    pid++;
+    count--;
+  }
+  if (count <= 0) return 0;
+
+  // pages of an earlier read-ahead that were never used are not kept any longer
+  for (int i = 0; i < CACHE_COUNT; i++) {
+    readCache[i].ahead = false;
+  }
+
+  // read all pages at once
+  char buffer[CACHE_COUNT / 2 * PAGE_SIZE];
+  if ((rc = seek(pid)) < 0) return rc;
+  if (::read(fd, buffer, count * PAGE_SIZE) < 0) return RC_FILE_READ_FAILED;
+
+  // and put the ones that are not cached yet into the cache
+  for (int n = 0; n < count; n++) {
+    int i;
+    for (i = 0; i < CACHE_COUNT; i++) {
+      if (readCache[i].fd == fd && readCache[i].pid == pid + n &&
+          readCache[i].lastAccessed != 0) break;
+    }
+    if (i == CACHE_COUNT) {
+      i = evictSlot();
+      readCache[i].fd = fd;
+      readCache[i].pid = pid + n;
+      memcpy(readCache[i].buffer, buffer + n * PAGE_SIZE, PAGE_SIZE);
+      readCache[i].ahead = true;
+    }
+    readCache[i].lastAccessed = ++cacheClock;
+  }
+
+  // increase the page read count
+  readCount += count;
+
+  return 0;
+}
+
+RC PageFile::readDirect(PageId pid, void* buffer, int count) const
+{
+  if (pid < 0 || count < 0 || pid + count > epid) return RC_INVALID_PID;
+
+  // pread() does not move the file cursor that read() seeks with
+  long bytes = (long) count * PAGE_SIZE;
+  if (::pread(fd, buffer, bytes, (off_t) pid * PAGE_SIZE) != bytes) {
+    return RC_FILE_READ_FAILED;
+  }
+
+  // increase the page read count
+  CacheLock lock;
+  readCount += count;
+
+  return 0;
+}
+
+int PageFile::evictSlot()
+{
+  int toEvict = -1;
+  for (int i = 0; i < CACHE_COUNT; i++) {
+    if (readCache[i].lastAccessed == 0) return i;
+    if (readCache[i].ahead) continue;
+    if (toEvict < 0 || readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
+      toEvict = i;
+    }
+  }
+  if (toEvict >= 0) return toEvict;
+
+  // every page was read ahead: fall back to plain LRU
+  toEvict = 0;
+  for (int i = 1; i < CACHE_COUNT; i++) {
+    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) toEvict = i;
+  }
+  return toEvict;
+}
@@ -58,6 +58,38 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * write count consecutive pages from the memory buffer with one disk write.
+   * the pages pid, pid+1, ..., pid+count-1 are written.
+   * @param pid[IN] the first page to write to
+   * @param buffer[IN] the content to write, count * PAGE_SIZE bytes
+   * @param count[IN] # pages to write
+   * @return error code. 0 if no error
+   */
+  RC write(PageId pid, const void *buffer, int count);
+
+  /**
+   * read count consecutive pages into the read cache with one disk read.
+   * pages past the end of the file are not read and at most CACHE_COUNT/2
+   * pages are read. a later read() of these pages is served by the cache,
+   * and they are not evicted before that unless the cache has no other page.
+   * @param pid[IN] the first page to read
+   * @param count[IN] # pages to read
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const;
+
+  /**
+   * read count consecutive pages into the memory buffer with one disk read,
+   * bypassing the read cache. unlike read(), it may be called from several
+   * threads at once.
+   * @param pid[IN] the first page to read
+   * @param buffer[OUT] room for count * PAGE_SIZE bytes
+   * @param count[IN] # pages to read
+   * @return error code. 0 if no error
+   */
+  RC readDirect(PageId pid, void *buffer, int count) const;
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -90,7 +122,8 @@ class PageFile {
   PageId  epid;   // (last page id + 1) of the file
 
   //
-  // the following set of members implement LRU caching 
+  // the following set of members implement LRU caching.
+  // they are shared by all threads and guarded by a lock in PageFile.cc
   //
   static const int CACHE_COUNT = 10;
 
@@ -102,9 +135,14 @@ class PageFile {
     PageId pid;             // page id of the cached page
     int    lastAccessed;    // the last time the cached page was accessed
                             //   (lastAccessed == 0) means that the buffer is empty
+    bool   ahead;           // read by prefetch() and not read() yet
     char buffer[PAGE_SIZE]; // the buffer used for caching
   } readCache[CACHE_COUNT];
 
+  // the cache slot to fill next: an empty one or the least recently used.
+  // pages read ahead are kept until they are used, if possible.
+  static int evictSlot();
+
   static int readCount;  // total # of page reads 
   static int writeCount; // total # of page writes 
 };
@@ -0,0 +1,239 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "Predicate.h"
+#include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+
+using std::string;
+using std::vector;
+
+//
+// one comparison function per comparator, so that a test is a single
+// indirect call with no switch on the comparator
+//
+template <SelCond::Comparator C>
+static bool testValue(const char* data, int length, const char* s, int n)
+{
+  int diff = Predicate::compareValue(data, length, s, n);
+  switch (C) {
+  case SelCond::NE: return diff != 0;
+  case SelCond::GT: return diff > 0;
+  case SelCond::LT: return diff < 0;
+  case SelCond::GE: return diff >= 0;
+  case SelCond::LE: return diff <= 0;
+  default:          return diff == 0;
+  }
+}
+
+// = only has to compare the bytes of values of the same length
+template <>
+bool testValue<SelCond::EQ>(const char* data, int length, const char* s, int n)
+{
+  return length == n && memcmp(data, s, n) == 0;
+}
+
+Predicate::Predicate(const vector<vector<SelCond> >& cond)
+{
+  vector<SelCond> none;     // no WHERE clause is a disjunct without conditions
+  unsigned        disjuncts = cond.empty() ? 1 : cond.size();
+
+  exclusions = false;
+  valueConds = false;
+  groups = false;
+
+  for (unsigned i = 0; i < disjuncts; i++) {
+    Conjunct c = compile(cond.empty() ? none : cond[i]);
+    if (c.lo > c.hi) continue;
+
+    conj.push_back(c);
+    exclusions = exclusions || !c.excluded.empty();
+    valueConds = valueConds || !c.valueTests.empty();
+    for (unsigned j = 0; j < c.groups.size(); j++) {
+      groups = true;
+      valueConds = valueConds || c.groups[j]->needsValue();
+    }
+
+    KeyRange r;
+    r.lo = c.lo;
+    r.hi = c.hi;
+    ranges.push_back(r);
+  }
+
+  // merge the ranges that overlap or touch
+  std::sort(ranges.begin(), ranges.end(), byLow);
+  unsigned n = 0;
+  for (unsigned i = 0; i < ranges.size(); i++) {
+    if (n > 0 && (ranges[n - 1].hi == INT_MAX || ranges[i].lo <= ranges[n - 1].hi + 1)) {
+      if (ranges[i].hi > ranges[n - 1].hi) ranges[n - 1].hi = ranges[i].hi;
+    } else {
+      ranges[n++] = ranges[i];
+    }
+  }
+  ranges.resize(n);
+
+  if (ranges.empty()) {
+    lo = INT_MAX;
+    hi = INT_MIN;
+  } else {
+    lo = ranges.front().lo;
+    hi = ranges.back().hi;
+  }
+  gaps = exclusions || groups || ranges.size() > 1;
+}
+
+Predicate::~Predicate()
+{
+  for (unsigned i = 0; i < nested.size(); i++) {
+    delete nested[i];
+  }
+}
+
+/*
+ * compile the conditions of a disjunct.
+ */
+Predicate::Conjunct Predicate::compile(const vector<SelCond>& cond)
+{
+  Conjunct c;
+
+  c.lo = INT_MIN;
+  c.hi = INT_MAX;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    // an OR group narrows the key range to the span of its ranges
+    if (cond[i].group != NULL) {
+      Predicate* g = new Predicate(*cond[i].group);
+      nested.push_back(g);
+      c.groups.push_back(g);
+      if (g->lo > c.lo) c.lo = g->lo;
+      if (g->hi < c.hi) c.hi = g->hi;
+      continue;
+    }
+
+    if (cond[i].attr == 2) {
+      ValueTest t;
+      t.operand = cond[i].value;
+      switch (cond[i].comp) {
+      case SelCond::EQ: t.test = testValue<SelCond::EQ>; t.rank = 0; break;
+      case SelCond::NE: t.test = testValue<SelCond::NE>; t.rank = 2; break;
+      case SelCond::LT: t.test = testValue<SelCond::LT>; t.rank = 1; break;
+      case SelCond::GT: t.test = testValue<SelCond::GT>; t.rank = 1; break;
+      case SelCond::LE: t.test = testValue<SelCond::LE>; t.rank = 1; break;
+      case SelCond::GE: t.test = testValue<SelCond::GE>; t.rank = 1; break;
+      }
+      c.valueTests.push_back(t);
+      continue;
+    }
+
+    // intersect the conditions on the key into [lo, hi]
+    int val = atoi(cond[i].value);
+    switch (cond[i].comp) {
+    case SelCond::EQ:
+      if (val > c.lo) c.lo = val;
+      if (val < c.hi) c.hi = val;
+      break;
+    case SelCond::NE:
+      c.excluded.push_back(val);
+      break;
+    case SelCond::LT:
+      if (val == INT_MIN) { c.lo = INT_MAX; c.hi = INT_MIN; }
+      else if (val - 1 < c.hi) c.hi = val - 1;
+      break;
+    case SelCond::LE:
+      if (val < c.hi) c.hi = val;
+      break;
+    case SelCond::GT:
+      if (val == INT_MAX) { c.lo = INT_MAX; c.hi = INT_MIN; }
+      else if (val + 1 > c.lo) c.lo = val + 1;
+      break;
+    case SelCond::GE:
+      if (val > c.lo) c.lo = val;
+      break;
+    }
+  }
+
+  // a range of a single excluded key is empty
+  if (c.lo == c.hi && !acceptKey(c, c.lo)) {
+    c.lo = INT_MAX;
+    c.hi = INT_MIN;
+  }
+
+  std::stable_sort(c.valueTests.begin(), c.valueTests.end(), byRank);
+  return c;
+}
+
+/*
+ * @return true if the key satisfies the key conditions of the disjunct
+ */
+bool Predicate::acceptKey(const Conjunct& c, int key)
+{
+  if (key < c.lo || key > c.hi) return false;
+  for (unsigned i = 0; i < c.excluded.size(); i++) {
+    if (key == c.excluded[i]) return false;
+  }
+  for (unsigned i = 0; i < c.groups.size(); i++) {
+    if (!c.groups[i]->matchKey(key)) return false;
+  }
+  return true;
+}
+
+/*
+ * find the range of the key with a binary search. only with <> in a
+ * disjunct are the disjuncts tested one by one.
+ */
+bool Predicate::acceptKey(int key) const
+{
+  int l = 0, h = ranges.size() - 1;
+  while (l < h) {
+    int m = (l + h + 1) / 2;
+    if (ranges[m].lo <= key) l = m;
+    else h = m - 1;
+  }
+  if (key < ranges[l].lo || key > ranges[l].hi) return false;
+  if (!exclusions && !groups) return true;
+
+  for (unsigned i = 0; i < conj.size(); i++) {
+    if (acceptKey(conj[i], key)) return true;
+  }
+  return false;
+}
+
+/*
+ * test the disjuncts one by one, with their OR groups.
+ */
+bool Predicate::matchAny(int key, const char* data, int length) const
+{
+  for (unsigned i = 0; i < conj.size(); i++) {
+    if (!acceptKey(conj[i], key) || !matchTests(conj[i], data, length)) continue;
+
+    bool match = true;
+    for (unsigned j = 0; j < conj[i].groups.size() && match; j++) {
+      match = conj[i].groups[j]->matchValue(key, data, length);
+    }
+    if (match) return true;
+  }
+  return false;
+}
+
+int Predicate::compareValue(const char* data, int length, const char* s, int n)
+{
+  int diff = memcmp(data, s, (length < n) ? length : n);
+  if (diff != 0) return diff;
+  return length - n;
+}
+
+bool Predicate::byRank(const ValueTest& a, const ValueTest& b)
+{
+  return a.rank < b.rank;
+}
+
+bool Predicate::byLow(const KeyRange& a, const KeyRange& b)
+{
+  return a.lo < b.lo;
+}
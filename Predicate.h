@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PREDICATE_H
+#define PREDICATE_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "SqlEngine.h"
+
+/**
+ * The conditions of a WHERE clause, compiled once per query so that
+ * testing a tuple parses nothing and switches on nothing.
+ * The clause is a list of disjuncts ORed together, each a list of
+ * conditions ANDed together. In every disjunct the conditions on the key
+ * other than <> are intersected into a single range, and the <>
+ * conditions become a list of excluded keys. The ranges of the disjuncts
+ * are merged into sorted, disjoint key ranges, and [low(), high()] spans
+ * all of them. Every condition on the value becomes a test that calls the
+ * comparison function for its comparator, with the string length known
+ * up front. The value tests run in the order of how many tuples they are
+ * likely to reject: = first, <> last. An OR group in a disjunct is
+ * compiled into a Predicate of its own: it narrows the key range of the
+ * disjunct to the span of its ranges, and every tuple in that span is
+ * tested against it.
+ */
+class Predicate {
+ public:
+
+  /**
+   * compile the conditions of a WHERE clause.
+   * @param cond[IN] the disjuncts, each a list of conditions ANDed
+   * together. no disjunct at all stands for no WHERE clause
+   */
+  Predicate(const std::vector<std::vector<SelCond> >& cond);
+  ~Predicate();
+
+  /**
+   * @return true if no key satisfies the key conditions
+   */
+  bool empty() const { return ranges.empty(); }
+
+  /**
+   * @return the smallest key that can satisfy the key conditions
+   */
+  int low() const { return lo; }
+
+  /**
+   * @return the largest key that can satisfy the key conditions
+   */
+  int high() const { return hi; }
+
+  /**
+   * @return # disjoint key ranges that the key conditions allow
+   */
+  int rangeCount() const { return ranges.size(); }
+
+  /**
+   * @param i[IN] the range, in key order
+   * @return the smallest key of the range
+   */
+  int rangeLow(int i) const { return ranges[i].lo; }
+
+  /**
+   * @param i[IN] the range, in key order
+   * @return the largest key of the range
+   */
+  int rangeHigh(int i) const { return ranges[i].hi; }
+
+  /**
+   * @return true if some keys in [low(), high()] are excluded by <>, lie
+   * between the ranges of an OR, or may fail an OR group
+   */
+  bool hasExclusions() const { return gaps; }
+
+  /**
+   * @return true if there is a condition on the value
+   */
+  bool needsValue() const { return valueConds; }
+
+  /**
+   * test the conditions on the key.
+   * @param key[IN] the key of the tuple
+   * @return true if the key satisfies all of them
+   */
+  bool matchKey(int key) const
+  {
+    if (key < lo || key > hi) return false;
+    return notExcluded(key);
+  }
+
+  /**
+   * test the <> conditions and the gaps between the ranges, for a key
+   * known to be in [low(), high()].
+   * @param key[IN] the key of the tuple
+   * @return true if the key satisfies the key conditions
+   */
+  bool notExcluded(int key) const
+  {
+    if (!gaps) return true;
+    if (conj.size() > 1 || groups) return acceptKey(key);
+    const std::vector<int>& excluded = conj[0].excluded;
+    for (unsigned i = 0; i < excluded.size(); i++) {
+      if (key == excluded[i]) return false;
+    }
+    return true;
+  }
+
+  /**
+   * test the conditions on the value, for a tuple whose key satisfies
+   * the key conditions. with OR, the value must satisfy the conditions
+   * of a disjunct whose key conditions the key satisfies.
+   * @param key[IN] the key of the tuple
+   * @param data[IN] the value, not zero-terminated
+   * @param length[IN] # bytes in the value
+   * @return true if the value satisfies them
+   */
+  bool matchValue(int key, const char* data, int length) const
+  {
+    if (conj.size() != 1 || groups) return matchAny(key, data, length);
+    return matchTests(conj[0], data, length);
+  }
+
+  /**
+   * compare a value that is not zero-terminated with a string, like strcmp.
+   * @return negative, zero or positive as the value is less than, equal to
+   * or greater than s
+   */
+  static int compareValue(const char* data, int length, const char* s, int n);
+
+ private:
+  // a comparison of a value with the operand of a condition
+  typedef bool (*ValueTestFn)(const char* data, int length, const char* s, int n);
+
+  struct ValueTest {
+    ValueTestFn test;
+    std::string operand;
+    int         rank;     // tests with a smaller rank run first
+  };
+
+  // the conditions of a disjunct
+  struct Conjunct {
+    int lo;                           // the key range
+    int hi;
+    std::vector<int> excluded;        // keys excluded by <>
+    std::vector<ValueTest> valueTests;
+    std::vector<const Predicate*> groups; // OR groups, owned by nested
+  };
+
+  struct KeyRange {
+    int lo;
+    int hi;
+  };
+
+  static bool byRank(const ValueTest& a, const ValueTest& b);
+  // the OR groups point into each other's Predicate, so it is not copied
+  Predicate(const Predicate&);
+  Predicate& operator=(const Predicate&);
+
+  static bool byLow(const KeyRange& a, const KeyRange& b);
+  Conjunct compile(const std::vector<SelCond>& cond);
+
+  static bool matchTests(const Conjunct& c, const char* data, int length)
+  {
+    for (unsigned i = 0; i < c.valueTests.size(); i++) {
+      const ValueTest& t = c.valueTests[i];
+      if (!t.test(data, length, t.operand.data(), t.operand.size())) return false;
+    }
+    return true;
+  }
+
+  static bool acceptKey(const Conjunct& c, int key);
+  bool acceptKey(int key) const;
+  bool matchAny(int key, const char* data, int length) const;
+
+  int lo;                          // the smallest and largest key of all ranges
+  int hi;
+  bool gaps;                       // some keys in [lo, hi] fail the key conditions
+  bool exclusions;                 // some disjunct has <> conditions on the key
+  bool valueConds;                 // some disjunct has conditions on the value
+  bool groups;                     // some disjunct has OR groups
+  std::vector<Conjunct> conj;      // the disjuncts that some key can satisfy
+  std::vector<KeyRange> ranges;    // the merged key ranges of conj, in key order
+  std::vector<Predicate*> nested;  // the compiled OR groups of all disjuncts
+};
+
+#endif // PREDICATE_H
@@ -10,8 +10,11 @@
 #include "Bruinbase.h"
 #include "RecordFile.h"
 #include <cstring>
+#include <climits>
+#include <pthread.h>
 
 using std::string;
+using std::vector;
 
 //
 // helper functions for page manipultation
@@ -20,9 +23,6 @@ using std::string;
 // compute the pointer to the n'th slot in a page
 static char* slotPtr(char* page, int n);
 
-// read the record in the n'th slot in the page
-static void readSlot(const char* page, int n, int& key, std::string& value);
-
 // write the record to the n'th slot in the page
 static void writeSlot(char* page, int n, int key, const std::string& value);
 
@@ -32,6 +32,102 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+//
+// helper functions for the slotted format
+//
+// layout of the header page (page 0):
+// [FILE_MAGIC][format][last data page][# pages]
+// the last data page is where the end record id lies, as of when the
+// file had # pages. 0 if unknown.
+//
+// layout of a slotted page:
+// [int # records][int start of the record area][slot 0][slot 1] ...
+//                      ... free space ... [record 1][record 0]
+// a slot is the (offset, length) of its record as two shorts. records
+// grow from the end of the page towards the slot directory.
+// a record is [int key][value bytes]. a value longer than MAX_VALUE_LENGTH
+// is stored in overflow pages, and the record is
+// [int key][int value length][PageId first overflow page] with
+// OVERFLOW_RECORD set in the slot length.
+//
+// layout of an overflow page: [int OVERFLOW_PAGE][PageId next][value bytes]
+// the negative record count tells scans to skip the page.
+//
+static const int FILE_MAGIC = 0x42425346;   // "BBSF"
+static const int PAGE_HEADER = 2 * sizeof(int);
+static const int SLOT_SIZE = 2 * sizeof(short);
+static const int OVERFLOW_RECORD = 0x4000;
+static const int OVERFLOW_PAGE = -1;
+static const int OVERFLOW_HEADER = sizeof(int) + sizeof(PageId);
+static const int OVERFLOW_CAPACITY = PageFile::PAGE_SIZE - OVERFLOW_HEADER;
+static const int HEADER_LAST_PAGE = 2 * sizeof(int);
+static const int HEADER_PAGE_COUNT = 3 * sizeof(int);
+
+//
+// helper functions for the columnar format
+//
+// the header page of a columnar file is
+// [FILE_MAGIC][format][# records][# bytes in the value heap]
+// and page 1 onwards hold KEYS_PER_PAGE keys each. record i is
+// (1 + i / KEYS_PER_PAGE, i % KEYS_PER_PAGE).
+// the offset file holds OFFSETS_PER_PAGE (offset, length) pairs per page
+// and the value heap is a plain byte stream split into pages.
+//
+static const int HEADER_ROW_COUNT = 2 * sizeof(int);
+static const int HEADER_HEAP_SIZE = 3 * sizeof(int);
+static const int OFFSETS_PER_PAGE = PageFile::PAGE_SIZE / (2 * sizeof(int));
+
+// a compressed slotted file keeps its dictionary in the header page:
+// [FILE_MAGIC][format][last data page][# pages][dictionary size][dictionary]
+static const int HEADER_DICT_SIZE = 4 * sizeof(int);
+static const int HEADER_DICT = 5 * sizeof(int);
+
+// the first int of a zone map file
+static const int ZONE_MAGIC = 0x5a4d5032;   // "ZMP2"
+
+// guards the lazy reading of zone maps by the workers of a scan
+static pthread_mutex_t zoneMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// the name of a file of the value column: "movie.tbl" -> "movie.off"
+static string columnName(const string& filename, const char* ext);
+
+// write len bytes of data at byte position pos of a file that is used as
+// one byte stream. all pages it touches are written with one disk write.
+static RC writeStream(PageFile& pf, int pos, const char* data, int len);
+
+// # overflow pages a value of len bytes takes
+static int overflowPages(int len);
+
+// write the overflow pages of a value to pages, the first of which
+// will be stored at page first
+static void fillOverflow(const string& value, PageId first, char* pages);
+
+// write the header of a slotted file to the page
+static void writeHeader(char* page, int format);
+
+// read the format from the first page of a file.
+// return a negative value if the page is neither a header nor a legacy page
+static int readHeader(const char* page, int& format);
+
+// initialize an empty slotted page
+static void initPage(char* page);
+
+// # bytes a record with a value of length n takes in a page, with its slot
+static int recordSize(int n, bool overflow);
+
+// # free bytes between the slot directory and the record area
+static int freeSpace(const char* page);
+
+// add a record to the next slot. the value is kept in the page unless
+// overflow is a valid page id
+static void addRecord(char* page, int key, const std::string& value, PageId overflow);
+
+// read the record in the n'th slot. value points to the value in the page.
+// return true if the value is in overflow pages instead, in which case
+// overflow and length tell where and how long it is
+static bool readRecord(const char* page, int n, int& key, const char*& value,
+                       int& length, PageId& overflow);
+
 
 //
 // helper functions for RecordId manipulation
@@ -105,22 +201,130 @@ bool operator != (const RecordId& r1, const RecordId& r2)
 
 RecordFile::RecordFile()
 {
+  brid.pid = brid.sid = 0;
   erid.pid = 0;
   erid.sid = 0;
+  format = LEGACY_FORMAT;
+  rowCount = heapSize = 0;
+  headerDirty = false;
+  zonesLoaded = zonesValid = zonesDirty = false;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  brid.pid = brid.sid = 0;
+  erid.pid = erid.sid = 0;
+  format = LEGACY_FORMAT;
+  rowCount = heapSize = 0;
+  headerDirty = false;
+  zonesLoaded = zonesValid = zonesDirty = false;
   open(filename, mode);
 }
 
-RC RecordFile::open(const string& filename, char mode)
+RC RecordFile::open(const string& filename, char mode, int newFormat)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+
+  //
+  // in the rest of this function, we find out the file format
+  // and set the begin and end record ids
+  //
+  brid.pid = brid.sid = 0;
+  format = LEGACY_FORMAT;
+  rowCount = heapSize = 0;
+  headerDirty = false;
+  dict.read(NULL, 0);
+  zones.clear();
+  zoneName.erase();
+  zonesLoaded = zonesValid = zonesDirty = false;
+
+  // a new file gets a header page and the slotted format, unless the
+  // caller asks for the columnar one. its first record goes to page 1.
+  if (pf.endPid() == 0 && (mode == 'w' || mode == 'W')) {
+    memset(page, 0, PageFile::PAGE_SIZE);
+    writeHeader(page, (newFormat == COLUMNAR_FORMAT) ? COLUMNAR_FORMAT : SLOTTED_FORMAT);
+    if ((rc = pf.write(0, page)) < 0) {
+      pf.close();
+      return rc;
+    }
+  }
+
+  // the first page of a slotted file is its header. in a legacy file, the
+  // first four bytes are the # records in the page and never the magic number.
+  if (pf.endPid() > 0) {
+    if ((rc = pf.read(0, page)) < 0) {
+      pf.close();
+      return rc;
+    }
+    if (readHeader(page, format) < 0) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+    if (format != LEGACY_FORMAT) {
+      brid.pid = 1;
+    }
+  }
+
+  if (format == SLOTTED_FORMAT) {
+    int size;
+    memcpy(&size, page + HEADER_DICT_SIZE, sizeof(int));
+    if (size < 0 || size > PageFile::PAGE_SIZE - HEADER_DICT ||
+        dict.read(page + HEADER_DICT, size) < 0) {
+      pf.close();
+      return RC_INVALID_FILE_FORMAT;
+    }
+  }
+
+  if (format == COLUMNAR_FORMAT) {
+    // the header keeps the # records and the size of the value heap
+    memcpy(&rowCount, page + HEADER_ROW_COUNT, sizeof(int));
+    memcpy(&heapSize, page + HEADER_HEAP_SIZE, sizeof(int));
+    erid.pid = 1 + rowCount / KEYS_PER_PAGE;
+    erid.sid = rowCount % KEYS_PER_PAGE;
+
+    if ((rc = openColumns(filename, mode)) < 0) {
+      pf.close();
+      return rc;
+    }
+    zoneName = columnName(filename, ".zm");
+    return 0;
+  }
+
+  if (format == SLOTTED_FORMAT) {
+    // the end record id follows the last record of the last data page.
+    // the header tells which page that is, unless pages were added
+    // since it was written. overflow pages may come after the last data
+    // page, and are skipped otherwise.
+    PageId lastPid;
+    int    pageCount;
+    memcpy(&lastPid, page + HEADER_LAST_PAGE, sizeof(PageId));
+    memcpy(&pageCount, page + HEADER_PAGE_COUNT, sizeof(int));
+    erid.pid = (lastPid >= 1 && lastPid < pageCount && pageCount == pf.endPid())
+      ? lastPid : pf.endPid() - 1;
+    erid.sid = 0;
+    while (erid.pid >= 1) {
+      if ((rc = pf.read(erid.pid, page)) < 0) {
+        erid.pid = erid.sid = 0;
+        pf.close();
+        return rc;
+      }
+      if (getRecordCount(page) >= 0) {
+        erid.sid = getRecordCount(page);
+        break;
+      }
+      erid.pid--;
+    }
+
+    // no data page yet
+    if (erid.pid < 1) erid.pid = 1;
+
+    zoneName = columnName(filename, ".zm");
+    return 0;
+  }
   
   //
   // in the rest of this function, we set the end record id
@@ -159,32 +363,139 @@ RC RecordFile::open(const string& filename, char mode)
 
 RC RecordFile::close()
 {
+  RC   rc = 0;
+  char page[PageFile::PAGE_SIZE];
+
+  if (format == COLUMNAR_FORMAT) {
+    // write the # records and the heap size back to the header page
+    if (headerDirty) {
+      if ((rc = pf.read(0, page)) == 0) {
+        memcpy(page + HEADER_ROW_COUNT, &rowCount, sizeof(int));
+        memcpy(page + HEADER_HEAP_SIZE, &heapSize, sizeof(int));
+        rc = pf.write(0, page);
+      }
+      headerDirty = false;
+    }
+    offsetFile.close();
+    heapFile.close();
+  }
+
+  if (format == SLOTTED_FORMAT && headerDirty) {
+    // keep the last data page, so that open() need not look for it
+    if ((rc = pf.read(0, page)) == 0) {
+      int pageCount = pf.endPid();
+      memcpy(page + HEADER_LAST_PAGE, &erid.pid, sizeof(PageId));
+      memcpy(page + HEADER_PAGE_COUNT, &pageCount, sizeof(int));
+      rc = pf.write(0, page);
+    }
+    headerDirty = false;
+  }
+  format = LEGACY_FORMAT;
+
+  // the zone map describes the file as of its end record id
+  if (zonesValid && zonesDirty) {
+    RC zrc = saveZones();
+    if (rc == 0) rc = zrc;
+  }
+  zones.clear();
+  zoneName.erase();
+  zonesLoaded = zonesValid = zonesDirty = false;
+
+  brid.pid = brid.sid = 0;
   erid.pid = 0;
   erid.sid = 0;
 
+  if (rc < 0) {
+    pf.close();
+    return rc;
+  }
   return pf.close();
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC          rc;
+  const char* data;
+  int         length;
+  ReadBuffer  buf;
+
+  if ((rc = read(rid, key, data, length, buf)) < 0) return rc;
+  value.assign(data, length);
+
+  return 0;
+}
+
+RC RecordFile::read(const RecordId& rid, int& key, const char*& value, int& length,
+                    ReadBuffer& buf) const
+{
+  RC rc;
   
   // check whether the rid is in the valid range
-  if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.pid < brid.pid || rid.pid > erid.pid) return RC_INVALID_RID;
+  if (rid.sid < 0) return RC_INVALID_RID;
+  if (format == LEGACY_FORMAT && rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
+
+  if (format == COLUMNAR_FORMAT) {
+    if ((rc = readColumnar(rid, key, buf.raw)) < 0) return rc;
+    value = buf.raw.data();
+    length = buf.raw.size();
+    return 0;
+  }
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // read the page containing the record. the value is returned
+  // where it lies in the page
+  if ((rc = pf.read(rid.pid, buf.page)) < 0) return rc;
+
+  if (format == LEGACY_FORMAT) {
+    // the value in the slot is terminated by a zero byte
+    const char* ptr = slotPtr(buf.page, rid.sid);
+    memcpy(&key, ptr, sizeof(int));
+    value = ptr + sizeof(int);
+    length = strlen(value);
+    return 0;
+  }
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  // the slot must exist in the page
+  if (rid.sid >= getRecordCount(buf.page)) return RC_INVALID_RID;
+
+  PageId overflow;
+  if (readRecord(buf.page, rid.sid, key, value, length, overflow)) {
+    if ((rc = readOverflow(overflow, length, buf.raw)) < 0) return rc;
+    value = buf.raw.data();
+    length = buf.raw.size();
+  }
+
+  // a compressed file stores the encoded value
+  if (!dict.empty()) {
+    dict.decode(value, length, buf.decoded);
+    value = buf.decoded.data();
+    length = buf.decoded.size();
+  }
 
   return 0;
 }
 
 RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+{
+  // the zone map must describe the records before this one
+  loadZones();
+
+  if (format == LEGACY_FORMAT) {
+    return appendLegacy(key, value, rid);
+  }
+  if (format == COLUMNAR_FORMAT) {
+    return appendColumnar(&key, &value, 1, &rid);
+  }
+  if (!dict.empty()) {
+    string encoded;
+    dict.encode(value, encoded);
+    return appendSlotted(key, encoded, rid);
+  }
+  return appendSlotted(key, value, rid);
+}
+
+RC RecordFile::appendLegacy(int key, const std::string& value, RecordId& rid)
 {
   RC   rc;
   char page[PageFile::PAGE_SIZE];
@@ -218,11 +529,702 @@ RC RecordFile::append(int key, const std::string& value, RecordId& rid)
   return 0;
 }
 
+RC RecordFile::appendSlotted(int key, const std::string& value, RecordId& rid)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  bool overflow = ((int) value.size() > MAX_VALUE_LENGTH);
+
+  // a record with a long value only keeps the overflow reference in the page
+  int size = recordSize(overflow ? 0 : value.size(), overflow);
+
+  // read the last data page, unless it has not been written yet
+  if (erid.pid < pf.endPid()) {
+    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+  } else {
+    initPage(page);
+  }
+
+  // start a new page at the end of the file if the record does not fit.
+  // it is written right away so that overflow pages go behind it.
+  if (freeSpace(page) < size) {
+    erid.pid = pf.endPid();
+    erid.sid = 0;
+    initPage(page);
+  }
+  if (overflow && erid.pid >= pf.endPid()) {
+    if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+  }
+
+  PageId first = -1;
+  if (overflow && (rc = writeOverflow(value, first)) < 0) return rc;
+
+  addRecord(page, key, value, first);
+
+  // write the page to the disk
+  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
+
+  // we need to output the rid of the record slot
+  rid = erid;
+  noteKey(erid.pid, key);
+
+  // the next record goes to the next slot of this page if it fits
+  erid.sid++;
+  headerDirty = true;
+
+  return 0;
+}
+
+RC RecordFile::appendBatch(const vector<int>& keys, const vector<string>& values, vector<RecordId>& rids)
+{
+  RC rc;
+  int count = keys.size();
+
+  if (values.size() != keys.size()) return RC_INVALID_ATTRIBUTE;
+  rids.resize(count);
+  if (count == 0) return 0;
+
+  // the zone map must describe the records before these
+  loadZones();
+
+  if (format == COLUMNAR_FORMAT) {
+    return appendColumnar(&keys[0], &values[0], count, &rids[0]);
+  }
+
+  // legacy files are only appended to, never created
+  if (format == LEGACY_FORMAT) {
+    for (int i = 0; i < count; i++) {
+      if ((rc = appendLegacy(keys[i], values[i], rids[i])) < 0) return rc;
+    }
+    return 0;
+  }
+
+  if (!dict.empty()) {
+    vector<string> encoded(count);
+    for (int i = 0; i < count; i++) {
+      dict.encode(values[i], encoded[i]);
+    }
+    return appendSlottedBatch(keys, encoded, rids);
+  }
+  return appendSlottedBatch(keys, values, rids);
+}
+
+RC RecordFile::appendSlottedBatch(const vector<int>& keys, const vector<string>& values, vector<RecordId>& rids)
+{
+  RC     rc;
+  char   last[PageFile::PAGE_SIZE];
+  PageId lastPid = erid.pid;
+  bool   haveLast = (erid.pid < pf.endPid());
+  bool   lastDirty = false;
+  int    count = keys.size();
+
+  // the records go to the last data page until it is full
+  if (haveLast && (rc = pf.read(lastPid, last)) < 0) return rc;
+
+  // the new pages are built in memory in the order that append() would
+  // write them: a data page, the overflow pages of its long values, the
+  // next data page and so on. they are consecutive in the file.
+  PageId       freshStart = pf.endPid();
+  vector<char> fresh;
+  int          cur = -1;  // index of the current data page in fresh
+  if (!haveLast) {
+    fresh.resize(PageFile::PAGE_SIZE);
+    initPage(&fresh[0]);
+    cur = 0;
+    erid.pid = freshStart;
+    erid.sid = 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    bool overflow = ((int) values[i].size() > MAX_VALUE_LENGTH);
+    int  size = recordSize(overflow ? 0 : values[i].size(), overflow);
+    char* page = (cur < 0) ? last : &fresh[cur * PageFile::PAGE_SIZE];
+
+    if (freeSpace(page) < size) {
+      cur = fresh.size() / PageFile::PAGE_SIZE;
+      fresh.resize(fresh.size() + PageFile::PAGE_SIZE);
+      page = &fresh[cur * PageFile::PAGE_SIZE];
+      initPage(page);
+      erid.pid = freshStart + cur;
+      erid.sid = 0;
+    }
+
+    PageId first = -1;
+    if (overflow) {
+      int n = overflowPages(values[i].size());
+      first = freshStart + fresh.size() / PageFile::PAGE_SIZE;
+      fresh.resize(fresh.size() + n * PageFile::PAGE_SIZE);
+      fillOverflow(values[i], first, &fresh[fresh.size() - n * PageFile::PAGE_SIZE]);
+
+      // resizing fresh may have moved the current page
+      page = (cur < 0) ? last : &fresh[cur * PageFile::PAGE_SIZE];
+    }
+
+    addRecord(page, keys[i], values[i], first);
+    if (cur < 0) lastDirty = true;
+
+    rids[i] = erid;
+    noteKey(erid.pid, keys[i]);
+    erid.sid++;
+  }
+  headerDirty = true;
+
+  // write every page once
+  if (lastDirty && (rc = pf.write(lastPid, last)) < 0) return rc;
+  if (!fresh.empty() &&
+      (rc = pf.write(freshStart, &fresh[0], fresh.size() / PageFile::PAGE_SIZE)) < 0) {
+    return rc;
+  }
+
+  return 0;
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+const RecordId& RecordFile::beginRid() const
+{
+  return brid;
+}
+
+RC RecordFile::next(RecordId& rid) const
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+
+  if (format == LEGACY_FORMAT) {
+    ++rid;
+    return 0;
+  }
+
+  // every page of the key column is full except the last one
+  if (format == COLUMNAR_FORMAT) {
+    if (++rid.sid >= KEYS_PER_PAGE) {
+      rid.pid++;
+      rid.sid = 0;
+    }
+    return 0;
+  }
+
+  // the last data page holds erid.sid records
+  if (rid.pid >= erid.pid) {
+    rid.sid++;
+    return 0;
+  }
+
+  // the page was read for the current record, so this is a cache hit
+  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  if (++rid.sid < getRecordCount(page)) return 0;
+
+  // move on to the first record of the next data page.
+  // overflow pages have a negative record count and are skipped.
+  for (rid.pid++, rid.sid = 0; rid.pid < erid.pid; rid.pid++) {
+    if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+    if (getRecordCount(page) > 0) break;
+  }
+
+  return 0;
+}
+
+RC RecordFile::compress(const vector<string>& samples)
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+
+  // the records that are already stored are not encoded
+  if (format != SLOTTED_FORMAT || erid != brid) return RC_INVALID_FILE_FORMAT;
+
+  dict.train(samples, PageFile::PAGE_SIZE - HEADER_DICT);
+
+  int size = dict.empty() ? 0 : dict.size();
+  if ((rc = pf.read(0, page)) < 0) return rc;
+  memcpy(page + HEADER_DICT_SIZE, &size, sizeof(int));
+  if (size > 0) dict.write(page + HEADER_DICT);
+
+  return pf.write(0, page);
+}
+
+bool RecordFile::mayContain(PageId pid, int low, int high) const
+{
+  if (!zonesLoaded || !zonesValid) return true;
+
+  // the entries are sorted by extent
+  int lo = 0, hi = zones.size() - 1;
+  while (lo <= hi) {
+    int mid = (lo + hi) / 2;
+    if (zones[mid].pid / ZONE_PAGES == pid / ZONE_PAGES) {
+      // pages without records, such as overflow pages, may lie around them
+      return pid >= zones[mid].pid && pid <= zones[mid].last &&
+        zones[mid].minKey <= high && zones[mid].maxKey >= low;
+    }
+    if (zones[mid].pid / ZONE_PAGES < pid / ZONE_PAGES) lo = mid + 1;
+    else hi = mid - 1;
+  }
+
+  // extents without records have no entry
+  return false;
+}
+
+int RecordFile::pagesInRange(int low, int high) const
+{
+  loadZones();
+  if (!zonesValid) return erid.pid - brid.pid + 1;
+
+  int pages = 0;
+  for (unsigned i = 0; i < zones.size(); i++) {
+    if (zones[i].minKey <= high && zones[i].maxKey >= low) {
+      pages += zones[i].last - zones[i].pid + 1;
+    }
+  }
+  return pages;
+}
+
+bool RecordFile::isClustered() const
+{
+  loadZones();
+  if (!zonesValid || zones.empty()) return false;
+
+  for (unsigned i = 0; i < zones.size(); i++) {
+    if (!zones[i].sorted) return false;
+    if (i > 0 && zones[i - 1].maxKey > zones[i].minKey) return false;
+  }
+  return true;
+}
+
+void RecordFile::noteKey(PageId pid, int key)
+{
+  if (!zonesValid) return;
+
+  // the records are appended in page order, so only the last extent grows
+  if (zones.empty() || zones.back().pid / ZONE_PAGES != pid / ZONE_PAGES) {
+    ZoneEntry z;
+    z.pid = z.last = pid;
+    z.minKey = z.maxKey = key;
+    z.count = 0;
+    z.sorted = 1;
+    zones.push_back(z);
+  }
+
+  ZoneEntry& z = zones.back();
+  if (key < z.maxKey) z.sorted = 0;
+  if (key < z.minKey) z.minKey = key;
+  if (key > z.maxKey) z.maxKey = key;
+  z.last = pid;
+  z.count++;
+  zonesDirty = true;
+}
+
+/*
+ * read the zone map the first time it is needed. the workers of a scan
+ * may ask for it at once, so it is read under a lock.
+ */
+void RecordFile::loadZones() const
+{
+  pthread_mutex_lock(&zoneMutex);
+  if (!zonesLoaded) {
+    zones.clear();
+
+    // a file without records starts a new zone map.
+    // a legacy file has none.
+    if (zoneName.empty()) zonesValid = false;
+    else if (erid == brid) zonesValid = true;
+    else zonesValid = readZoneFile();
+
+    if (!zonesValid) zones.clear();
+    zonesLoaded = true;
+  }
+  pthread_mutex_unlock(&zoneMutex);
+}
+
+bool RecordFile::readZoneFile() const
+{
+  PageFile zf;
+  int      header[4];
+
+  // the zone map is only used if it was written for the current end
+  // record id. otherwise some records were appended without it.
+  if (zf.open(zoneName, 'r') < 0) return false;
+
+  // it is small and read once per open, with one disk read around the
+  // page cache, so that it does not evict the pages of the index
+  vector<char> buf(zf.endPid() * PageFile::PAGE_SIZE);
+  RC rc = buf.empty() ? 0 : zf.readDirect(0, &buf[0], zf.endPid());
+  zf.close();
+  if (rc < 0) return false;
+
+  if (buf.size() < sizeof(header)) return false;
+  memcpy(header, &buf[0], sizeof(header));
+  if (header[0] != ZONE_MAGIC || header[1] != erid.pid || header[2] != erid.sid) return false;
+  if (header[3] < 0 || sizeof(header) + header[3] * sizeof(ZoneEntry) > buf.size()) return false;
+
+  zones.resize(header[3]);
+  if (header[3] > 0) {
+    memcpy(&zones[0], &buf[sizeof(header)], header[3] * sizeof(ZoneEntry));
+  }
+  return true;
+}
+
+RC RecordFile::saveZones()
+{
+  RC       rc;
+  PageFile zf;
+  int      header[4] = { ZONE_MAGIC, erid.pid, erid.sid, (int) zones.size() };
+
+  // [ZONE_MAGIC][end pid][end sid][# entries][entries ...]
+  vector<char> buf(sizeof(header) + zones.size() * sizeof(ZoneEntry));
+  memcpy(&buf[0], header, sizeof(header));
+  if (!zones.empty()) {
+    memcpy(&buf[sizeof(header)], &zones[0], zones.size() * sizeof(ZoneEntry));
+  }
+
+  if ((rc = zf.open(zoneName, 'w')) < 0) return rc;
+  rc = writeStream(zf, 0, &buf[0], buf.size());
+  zf.close();
+  zonesDirty = false;
+
+  return rc;
+}
+
+RC RecordFile::openColumns(const string& filename, char mode)
+{
+  RC rc;
+
+  if ((rc = offsetFile.open(columnName(filename, ".off"), mode)) < 0) return rc;
+  if ((rc = heapFile.open(columnName(filename, ".val"), mode)) < 0) {
+    offsetFile.close();
+    return rc;
+  }
+
+  return 0;
+}
+
+RC RecordFile::appendColumnar(const int* keys, const string* values, int count, RecordId* rids)
+{
+  RC  rc;
+  int offset[2];
+
+  // lay out the keys, the offsets and the value bytes of all records
+  // and write each of the three files once
+  vector<int>  offsets(2 * count);
+  string       heap;
+  for (int i = 0; i < count; i++) {
+    offset[0] = heapSize + heap.size();
+    offset[1] = values[i].size();
+    memcpy(&offsets[2 * i], offset, sizeof(offset));
+    heap += values[i];
+  }
+
+  int pos = PageFile::PAGE_SIZE + rowCount * sizeof(int);
+  if ((rc = writeStream(pf, pos, (const char*) keys, count * sizeof(int))) < 0) return rc;
+  pos = rowCount * sizeof(offset);
+  if ((rc = writeStream(offsetFile, pos, (const char*) &offsets[0], count * sizeof(offset))) < 0) return rc;
+  if ((rc = writeStream(heapFile, heapSize, heap.data(), heap.size())) < 0) return rc;
+
+  for (int i = 0; i < count; i++) {
+    rids[i] = erid;
+    noteKey(erid.pid, keys[i]);
+    if (++erid.sid >= KEYS_PER_PAGE) {
+      erid.pid++;
+      erid.sid = 0;
+    }
+  }
+
+  rowCount += count;
+  heapSize += heap.size();
+  headerDirty = true;
+
+  return 0;
+}
+
+RC RecordFile::readColumnar(const RecordId& rid, int& key, string& value) const
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+  int  offset[2];
+
+  if (rid.sid >= KEYS_PER_PAGE) return RC_INVALID_RID;
+  int row = (rid.pid - 1) * KEYS_PER_PAGE + rid.sid;
+
+  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  memcpy(&key, page + rid.sid * sizeof(int), sizeof(int));
+
+  if ((rc = offsetFile.read(row / OFFSETS_PER_PAGE, page)) < 0) return rc;
+  memcpy(offset, page + (row % OFFSETS_PER_PAGE) * sizeof(offset), sizeof(offset));
+  if (offset[0] < 0 || offset[1] < 0 || offset[0] + offset[1] > heapSize) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // collect the value from the heap pages it spans
+  value.erase();
+  while ((int) value.size() < offset[1]) {
+    int pos = offset[0] + value.size();
+    int start = pos % PageFile::PAGE_SIZE;
+    int len = offset[1] - value.size();
+    if (len > PageFile::PAGE_SIZE - start) len = PageFile::PAGE_SIZE - start;
+
+    if ((rc = heapFile.read(pos / PageFile::PAGE_SIZE, page)) < 0) return rc;
+    value.append(page + start, len);
+  }
+
+  return 0;
+}
+
+RC RecordFile::readKeys(PageId pid, int* keys, int& count) const
+{
+  RC rc;
+
+  count = 0;
+  if (format != COLUMNAR_FORMAT) return RC_INVALID_FILE_FORMAT;
+  if (pid < brid.pid || pid > erid.pid) return RC_INVALID_PID;
+
+  // the last page may be partially filled
+  count = (pid < erid.pid) ? KEYS_PER_PAGE : erid.sid;
+  if (count == 0) return 0;
+
+  if ((rc = pf.read(pid, keys)) < 0) {
+    count = 0;
+    return rc;
+  }
+
+  return 0;
+}
+
+RecordFile::Scanner::Scanner(const RecordFile& rf)
+{
+  this->rf = &rf;
+  low = INT_MIN;
+  high = INT_MAX;
+  first = rf.brid.pid;
+  last = rf.erid.pid;
+  direct = false;
+  pid = -1;
+  n = 0;
+  page = pageBuf;
+  runFirst = -1;
+  runCount = 0;
+}
+
+void RecordFile::Scanner::setKeyRange(int low, int high)
+{
+  // the pages are skipped by the zone map
+  rf->loadZones();
+
+  this->low = low;
+  this->high = high;
+}
+
+void RecordFile::Scanner::setPageRange(PageId first, PageId last)
+{
+  this->first = (first > rf->brid.pid) ? first : rf->brid.pid;
+  this->last = (last < rf->erid.pid) ? last : rf->erid.pid;
+  direct = true;
+  run.resize(RUN_PAGES * PageFile::PAGE_SIZE);
+}
+
+/*
+ * make page point to page pid of the table.
+ */
+RC RecordFile::Scanner::loadPage()
+{
+  RC rc;
+
+  if (!direct) {
+    page = pageBuf;
+    return rf->pf.read(pid, pageBuf);
+  }
+
+  if (pid < runFirst || pid >= runFirst + runCount) {
+    // read the page together with the pages after it that the scan needs
+    int count = 1;
+    while (count < RUN_PAGES && pid + count <= last && pid + count < rf->pf.endPid() &&
+           rf->mayContain(pid + count, low, high)) {
+      count++;
+    }
+    if ((rc = rf->pf.readDirect(pid, &run[0], count)) < 0) {
+      runCount = 0;
+      return rc;
+    }
+    runFirst = pid;
+    runCount = count;
+  }
+
+  page = &run[(pid - runFirst) * PageFile::PAGE_SIZE];
+  return 0;
+}
+
+RC RecordFile::Scanner::nextPage()
+{
+  RC rc;
+
+  n = 0;
+  pid = (pid < 0) ? first : pid + 1;
+
+  for (; pid <= last; pid++) {
+    // skip the page without reading it if the zone map rules it out
+    if (!rf->mayContain(pid, low, high)) continue;
+
+    if (rf->format == COLUMNAR_FORMAT && !direct) {
+      if ((rc = rf->readKeys(pid, keyBuf, n)) < 0) return rc;
+      if (n > 0) return 0;
+      continue;
+    }
+
+    // the page after the last record is not in the file yet
+    if (pid >= rf->pf.endPid()) break;
+    if ((rc = loadPage()) < 0) return rc;
+    if ((rc = parsePage()) < 0) return rc;
+    if (n > 0) return 0;
+  }
+
+  pid = last + 1;
+  return RC_END_OF_FILE;
+}
+
+RC RecordFile::Scanner::readPage(PageId pid)
+{
+  RC rc;
+
+  n = 0;
+  if (pid < rf->brid.pid || pid > rf->erid.pid || pid >= rf->pf.endPid()) return RC_INVALID_PID;
+
+  this->pid = pid;
+  page = pageBuf;
+  if ((rc = rf->pf.readDirect(pid, pageBuf, 1)) < 0) return rc;
+
+  return parsePage();
+}
+
+/*
+ * take the keys and the slots of the records out of the loaded page.
+ */
+RC RecordFile::Scanner::parsePage()
+{
+  n = 0;
+
+  // a page of a columnar table holds its keys only
+  if (rf->format == COLUMNAR_FORMAT) {
+    n = (pid < rf->erid.pid) ? KEYS_PER_PAGE : rf->erid.sid;
+    memcpy(keyBuf, page, n * sizeof(int));
+    return 0;
+  }
+
+  // overflow pages have a negative record count
+  int count = getRecordCount(page);
+  if (count <= 0) return 0;
+  if (pid == rf->erid.pid && count > rf->erid.sid) count = rf->erid.sid;
+
+  if (rf->format == LEGACY_FORMAT) {
+    if (count > RECORDS_PER_PAGE) return RC_INVALID_FILE_FORMAT;
+    for (int i = 0; i < count; i++) {
+      memcpy(&keyBuf[i], slotPtr(page, i), sizeof(int));
+    }
+  } else {
+    if (count > KEYS_PER_PAGE) return RC_INVALID_FILE_FORMAT;
+    for (int i = 0; i < count; i++) {
+      const char* slot = page + PAGE_HEADER + SLOT_SIZE * i;
+      memcpy(&offset[i], slot, sizeof(short));
+      memcpy(&size[i], slot + sizeof(short), sizeof(short));
+      memcpy(&keyBuf[i], page + offset[i], sizeof(int));
+    }
+  }
+
+  n = count;
+  return 0;
+}
+
+RecordId RecordFile::Scanner::rid(int i) const
+{
+  RecordId r;
+  r.pid = pid;
+  r.sid = i;
+  return r;
+}
+
+RC RecordFile::Scanner::value(int i, const char*& data, int& length)
+{
+  RC     rc;
+  int    key;
+  PageId first;
+
+  if (i < 0 || i >= n) return RC_INVALID_RID;
+
+  switch (rf->format) {
+  case LEGACY_FORMAT:
+    data = slotPtr(page, i) + sizeof(int);
+    length = strlen(data);
+    return 0;
+
+  case COLUMNAR_FORMAT:
+    if ((rc = rf->readColumnar(rid(i), key, raw)) < 0) return rc;
+    data = raw.data();
+    length = raw.size();
+    return 0;
+  }
+
+  // a long value is read from its overflow pages
+  if (size[i] & OVERFLOW_RECORD) {
+    memcpy(&length, page + offset[i] + sizeof(int), sizeof(int));
+    memcpy(&first, page + offset[i] + 2 * sizeof(int), sizeof(PageId));
+    if ((rc = rf->readOverflow(first, length, raw)) < 0) return rc;
+    data = raw.data();
+    length = raw.size();
+  } else {
+    data = page + offset[i] + sizeof(int);
+    length = size[i] - sizeof(int);
+  }
+
+  if (!rf->dict.empty()) {
+    rf->dict.decode(data, length, decoded);
+    data = decoded.data();
+    length = decoded.size();
+  }
+
+  return 0;
+}
+
+bool RecordFile::Scanner::valueInPage(int i) const
+{
+  switch (rf->format) {
+  case LEGACY_FORMAT:
+    return true;
+  case COLUMNAR_FORMAT:
+    return false;
+  }
+  return !(size[i] & OVERFLOW_RECORD) && rf->dict.empty();
+}
+
+RC RecordFile::writeOverflow(const string& value, PageId& first)
+{
+  // the pages of a value are consecutive and written at once
+  vector<char> pages(overflowPages(value.size()) * PageFile::PAGE_SIZE);
+
+  first = pf.endPid();
+  fillOverflow(value, first, &pages[0]);
+
+  return pf.write(first, &pages[0], overflowPages(value.size()));
+}
+
+RC RecordFile::readOverflow(PageId pid, int length, string& value) const
+{
+  RC   rc;
+  char page[PageFile::PAGE_SIZE];
+
+  value.erase();
+  while ((int) value.size() < length && pid > 0) {
+    if ((rc = pf.read(pid, page)) < 0) return rc;
+    if (getRecordCount(page) != OVERFLOW_PAGE) return RC_INVALID_FILE_FORMAT;
+
+    int n = length - value.size();
+    if (n > OVERFLOW_CAPACITY) n = OVERFLOW_CAPACITY;
+    value.append(page + OVERFLOW_HEADER, n);
+    memcpy(&pid, page + sizeof(int), sizeof(PageId));
+  }
+
+  return 0;
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -247,18 +1249,6 @@ static char* slotPtr(char* page, int n)
   return (page+sizeof(int)) + (sizeof(int)+RecordFile::MAX_VALUE_LENGTH)*n;
 }
 
-static void readSlot(const char* page, int n, int& key, std::string& value)
-{
-  // compute the location of the record
-  char *ptr = slotPtr(const_cast<char*>(page), n);
-
-  // read the key 
-  memcpy(&key, ptr, sizeof(int));
-
-  // read the value
-  value.assign(ptr + sizeof(int));
-}
-
 static void writeSlot(char* page, int n, int key, const std::string& value)
 {
   // compute the location of the record
@@ -276,3 +1266,155 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
     strcpy(ptr + sizeof(int), value.c_str());
   }
 }
+
+static void writeHeader(char* page, int format)
+{
+  memcpy(page, &FILE_MAGIC, sizeof(int));
+  memcpy(page + sizeof(int), &format, sizeof(int));
+}
+
+static int readHeader(const char* page, int& format)
+{
+  int magic;
+  memcpy(&magic, page, sizeof(int));
+
+  if (magic == FILE_MAGIC) {
+    memcpy(&format, page + sizeof(int), sizeof(int));
+    return (format == RecordFile::SLOTTED_FORMAT ||
+            format == RecordFile::COLUMNAR_FORMAT) ? 0 : RC_INVALID_FILE_FORMAT;
+  }
+
+  // a legacy page starts with its # records
+  format = RecordFile::LEGACY_FORMAT;
+  return (magic >= 0 && magic <= RecordFile::RECORDS_PER_PAGE) ? 0 : RC_INVALID_FILE_FORMAT;
+}
+
+static void initPage(char* page)
+{
+  int end = PageFile::PAGE_SIZE;
+
+  memset(page, 0, PageFile::PAGE_SIZE);
+  setRecordCount(page, 0);
+  memcpy(page + sizeof(int), &end, sizeof(int));
+}
+
+static int recordSize(int n, bool overflow)
+{
+  if (overflow) {
+    return SLOT_SIZE + sizeof(int) + sizeof(int) + sizeof(PageId);
+  }
+  return SLOT_SIZE + sizeof(int) + n;
+}
+
+static int freeSpace(const char* page)
+{
+  int end;
+  memcpy(&end, page + sizeof(int), sizeof(int));
+  return end - PAGE_HEADER - SLOT_SIZE * getRecordCount(page);
+}
+
+static void addRecord(char* page, int key, const std::string& value, PageId overflow)
+{
+  int   count = getRecordCount(page);
+  int   end;
+  short offset, length;
+
+  memcpy(&end, page + sizeof(int), sizeof(int));
+
+  if (overflow > 0) {
+    int n = value.size();
+    length = sizeof(int) + sizeof(int) + sizeof(PageId);
+    end -= length;
+    memcpy(page + end, &key, sizeof(int));
+    memcpy(page + end + sizeof(int), &n, sizeof(int));
+    memcpy(page + end + 2 * sizeof(int), &overflow, sizeof(PageId));
+    offset = end;
+    length |= OVERFLOW_RECORD;
+  } else {
+    length = sizeof(int) + value.size();
+    end -= length;
+    memcpy(page + end, &key, sizeof(int));
+    memcpy(page + end + sizeof(int), value.data(), value.size());
+    offset = end;
+  }
+
+  // append the slot and update the header
+  char* slot = page + PAGE_HEADER + SLOT_SIZE * count;
+  memcpy(slot, &offset, sizeof(short));
+  memcpy(slot + sizeof(short), &length, sizeof(short));
+  memcpy(page + sizeof(int), &end, sizeof(int));
+  setRecordCount(page, count + 1);
+}
+
+static bool readRecord(const char* page, int n, int& key, const char*& value,
+                       int& length, PageId& overflow)
+{
+  short offset, size;
+  const char* slot = page + PAGE_HEADER + SLOT_SIZE * n;
+
+  memcpy(&offset, slot, sizeof(short));
+  memcpy(&size, slot + sizeof(short), sizeof(short));
+  memcpy(&key, page + offset, sizeof(int));
+
+  if (size & OVERFLOW_RECORD) {
+    memcpy(&length, page + offset + sizeof(int), sizeof(int));
+    memcpy(&overflow, page + offset + 2 * sizeof(int), sizeof(PageId));
+    return true;
+  }
+
+  value = page + offset + sizeof(int);
+  length = size - sizeof(int);
+  return false;
+}
+
+static string columnName(const string& filename, const char* ext)
+{
+  string::size_type dot = filename.rfind('.');
+  string::size_type slash = filename.rfind('/');
+  if (dot != string::npos && (slash == string::npos || dot > slash)) {
+    return filename.substr(0, dot) + ext;
+  }
+  return filename + ext;
+}
+
+static RC writeStream(PageFile& pf, int pos, const char* data, int len)
+{
+  RC     rc;
+  PageId first = pos / PageFile::PAGE_SIZE;
+  int    start = pos % PageFile::PAGE_SIZE;
+  int    count = (start + len + PageFile::PAGE_SIZE - 1) / PageFile::PAGE_SIZE;
+
+  if (len <= 0) return 0;
+
+  // keep what is already in the first page
+  vector<char> pages(count * PageFile::PAGE_SIZE, 0);
+  if (start > 0 && first < pf.endPid()) {
+    if ((rc = pf.read(first, &pages[0])) < 0) return rc;
+  }
+  memcpy(&pages[start], data, len);
+
+  return pf.write(first, &pages[0], count);
+}
+
+static int overflowPages(int len)
+{
+  return (len + OVERFLOW_CAPACITY - 1) / OVERFLOW_CAPACITY;
+}
+
+// every overflow page is [int OVERFLOW_PAGE][PageId next][value bytes]
+static void fillOverflow(const string& value, PageId first, char* pages)
+{
+  int count = overflowPages(value.size());
+
+  memset(pages, 0, count * PageFile::PAGE_SIZE);
+  for (int i = 0; i < count; i++) {
+    char*  page = pages + i * PageFile::PAGE_SIZE;
+    PageId next = (i + 1 < count) ? first + i + 1 : -1;
+    int    n = value.size() - i * OVERFLOW_CAPACITY;
+    if (n > OVERFLOW_CAPACITY) n = OVERFLOW_CAPACITY;
+
+    setRecordCount(page, OVERFLOW_PAGE);
+    memcpy(page + sizeof(int), &next, sizeof(PageId));
+    memcpy(page + OVERFLOW_HEADER, value.data() + i * OVERFLOW_CAPACITY, n);
+  }
+}
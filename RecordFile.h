@@ -11,7 +11,9 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
+#include "ValueDictionary.h"
 
 /**
  * The data structure for pointing to a particular record in a RecordFile.
@@ -52,6 +54,39 @@ class RecordFile {
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
 
+  // file formats.
+  // LEGACY_FORMAT files store RECORDS_PER_PAGE fixed-size slots per page
+  // and truncate values to MAX_VALUE_LENGTH - 1 characters.
+  // SLOTTED_FORMAT files start with a header page that records the format,
+  // followed by slotted pages of variable-length records. values longer
+  // than MAX_VALUE_LENGTH are stored in overflow pages.
+  // a SLOTTED_FORMAT file may keep a ValueDictionary in its header page,
+  // in which case every value is stored encoded with it.
+  // COLUMNAR_FORMAT files keep the keys as a dense int array after the
+  // header page. the values go to two files next to it: "<name>.off" holds
+  // the (offset, length) of every value and "<name>.val" their bytes back
+  // to back. a scan over the keys alone reads KEYS_PER_PAGE keys per page.
+  // new files are created in SLOTTED_FORMAT unless open() is told otherwise;
+  // LEGACY_FORMAT files can still be read and appended to.
+  static const int LEGACY_FORMAT   = 1;
+  static const int SLOTTED_FORMAT  = 2;
+  static const int COLUMNAR_FORMAT = 3;
+
+  // number of keys per page of a COLUMNAR_FORMAT file
+  static const int KEYS_PER_PAGE = PageFile::PAGE_SIZE / sizeof(int);
+
+  /**
+   * the room that read() returns a value from without copying it: the
+   * page of the record, or the value if it had to be decoded or read from
+   * overflow pages. every reader of a RecordFile keeps its own, so that
+   * reads by several readers do not overwrite each other's values.
+   */
+  struct ReadBuffer {
+    char        page[PageFile::PAGE_SIZE];
+    std::string raw;      // a value read from overflow pages or a column file
+    std::string decoded;  // a value decoded with the dictionary
+  };
+
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
@@ -60,9 +95,10 @@ class RecordFile {
    * when opened in 'w' mode, if the file does not exist, it is created.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param newFormat[IN] the format of the file if it is created
    * @return error code. 0 if no error
    */
-  RC open(const std::string& filename, char mode);
+  RC open(const std::string& filename, char mode, int newFormat = SLOTTED_FORMAT);
 
   /**
    * close the file.
@@ -79,6 +115,20 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * read a record from the file without copying its value.
+   * the value points into buf, and is valid until buf is passed to the
+   * next read().
+   * @param rid[IN] the id of the record to read
+   * @param key[OUT] the record key
+   * @param value[OUT] the value bytes. they are not zero-terminated
+   * @param length[OUT] # bytes in the value
+   * @param buf[IN] the room to read the record into
+   * @return error code. 0 if no error
+   */
+  RC read(const RecordId& rid, int& key, const char*& value, int& length,
+          ReadBuffer& buf) const;
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -90,15 +140,261 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append many records at the end of the file. the pages are filled in
+   * memory and every page is written once, the new pages of the file
+   * with a single disk write.
+   * @param keys[IN] the record keys
+   * @param values[IN] the record values, one for every key
+   * @param rids[OUT] the locations of the stored records
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(const std::vector<int>& keys, const std::vector<std::string>& values,
+                 std::vector<RecordId>& rids);
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * @return the record id of the first record slot of the RecordFile
+   */
+  const RecordId& beginRid() const;
+
+  /**
+   * move rid to the next record of the file. since the # records in a page
+   * depends on their sizes, scans should use next() rather than ++rid.
+   * after the last record, rid becomes endRid().
+   * @param rid[IN/OUT] the record id to advance
+   * @return error code. 0 if no error
+   */
+  RC next(RecordId& rid) const;
+
+  /**
+   * compress the values of the file with a dictionary trained on samples.
+   * only a SLOTTED_FORMAT file without any record can be compressed.
+   * the dictionary is kept in the header page, and read() decodes the
+   * values, so the callers see the original values.
+   * @param samples[IN] values that are representative of the table
+   * @return error code. 0 if no error
+   */
+  RC compress(const std::vector<std::string>& samples);
+
+  /**
+   * @return true if the values of the file are compressed
+   */
+  bool isCompressed() const { return !dict.empty(); }
+
+  /**
+   * read the keys stored in a page of a COLUMNAR_FORMAT file.
+   * the keys of the records (pid, 0) ... (pid, count-1) are copied to keys.
+   * @param pid[IN] the page to read. it is the pid of its records' ids
+   * @param keys[OUT] array of at least KEYS_PER_PAGE ints
+   * @param count[OUT] # keys in the page
+   * @return error code. 0 if no error
+   */
+  RC readKeys(PageId pid, int* keys, int& count) const;
+
+  /**
+   * @return the format of the file, LEGACY_FORMAT, SLOTTED_FORMAT
+   * or COLUMNAR_FORMAT
+   */
+  int getFormat() const { return format; }
+
+  // # pages that share a zone map entry
+  static const int ZONE_PAGES = 16;
+
+  /**
+   * check the zone map, which keeps the smallest and the largest key of
+   * every extent of ZONE_PAGES pages of a SLOTTED_FORMAT or COLUMNAR_FORMAT
+   * file in a file next to it ("<name>.zm"). it is read the first time a
+   * scan, pagesInRange(), isClustered() or an append needs it, kept up to
+   * date by append() and appendBatch() and written by close().
+   * mayContain() itself does not read it, so that the workers of a scan
+   * can call it at once; Scanner::setKeyRange() reads it first.
+   * @param pid[IN] the page to check
+   * @param low[IN] the smallest key of interest
+   * @param high[IN] the largest key of interest
+   * @return false if no record in the page has a key in [low, high].
+   * true if one may have, or if the zone map is not read or not usable
+   */
+  bool mayContain(PageId pid, int low, int high) const;
+
+  /**
+   * @param low[IN] the smallest key of interest
+   * @param high[IN] the largest key of interest
+   * @return # pages that a scan for the keys in [low, high] reads, that is
+   * the pages of the extents that the zone map does not rule out
+   */
+  int pagesInRange(int low, int high) const;
+
+  /**
+   * a file is clustered if its zone map shows the keys ascending through
+   * the file, as after "LOAD ... CLUSTERED". the records of a key range then
+   * lie on a few consecutive pages.
+   * @return true if the file is clustered on its key
+   */
+  bool isClustered() const;
+
+  /**
+   * read up to count consecutive pages starting at pid into the page cache
+   * with one disk read, so that reading their records next costs nothing.
+   * @param pid[IN] the first page to read
+   * @param count[IN] # pages to read
+   * @return error code. 0 if no error
+   */
+  RC prefetch(PageId pid, int count) const { return pf.prefetch(pid, count); }
+
+  /**
+   * reads a RecordFile a page at a time. once nextPage() has loaded a
+   * page, the keys of all of its records are available at once through
+   * keys(), so filters can run over the whole page in a tight loop, and
+   * the values through value() without copying the page again.
+   * the RecordFile must stay open while the scanner is used.
+   */
+  class Scanner {
+   public:
+    static const int RUN_PAGES = 64;  // pages read at once in a page range
+
+    Scanner(const RecordFile& rf);
+
+    /**
+     * load the next page of records. the first call loads the first page.
+     * pages without records are skipped.
+     * @return error code. 0 if no error, RC_END_OF_FILE after the last page
+     */
+    RC nextPage();
+
+    /**
+     * skip the pages that the zone map rules out for the key range.
+     * the pages that are loaded may still have keys outside it.
+     * @param low[IN] the smallest key of interest
+     * @param high[IN] the largest key of interest
+     */
+    void setKeyRange(int low, int high);
+
+    /**
+     * scan only the pages first to last, for example a share of the table
+     * scanned by one of several threads. the pages are read straight from
+     * the file, up to RUN_PAGES consecutive pages at once, so that scanners
+     * of different ranges do not contend for the page cache.
+     * @param first[IN] the first page to scan
+     * @param last[IN] the last page to scan
+     */
+    void setPageRange(PageId first, PageId last);
+
+    /**
+     * load page pid of the table, whatever the key and page ranges, to read
+     * some of its records by their position. the page is read straight from
+     * the file like the pages of a page range.
+     * @param pid[IN] the page to load
+     * @return error code. 0 if no error
+     */
+    RC readPage(PageId pid);
+
+    /**
+     * @return # records in the loaded page
+     */
+    int count() const { return n; }
+
+    /**
+     * @return the keys of the records in the loaded page
+     */
+    const int* keys() const { return keyBuf; }
+
+    /**
+     * @param i[IN] the position of a record in the loaded page
+     * @return the record id of the record
+     */
+    RecordId rid(int i) const;
+
+    /**
+     * get the value of a record in the loaded page. the value points into
+     * the page unless it has to be decoded or read from overflow pages.
+     * it stays valid until the next call to value() or nextPage().
+     * @param i[IN] the position of a record in the loaded page
+     * @param data[OUT] the value bytes
+     * @param length[OUT] # bytes in the value
+     * @return error code. 0 if no error
+     */
+    RC value(int i, const char*& data, int& length);
+
+    /**
+     * @param i[IN] the position of a record in the loaded page
+     * @return true if value() returns the value where it lies in the
+     * loaded page, so that it stays valid until the next nextPage()
+     */
+    bool valueInPage(int i) const;
+
+   private:
+    RC loadPage();
+    RC parsePage();
+
+    const RecordFile* rf;
+    int    low, high;                // the key range of interest
+    PageId first, last;              // the pages to scan
+    bool   direct;                   // read the pages around the cache
+    PageId pid;                      // the loaded page. -1 before the first page
+    int    n;                        // # records in the loaded page
+    int    keyBuf[KEYS_PER_PAGE];    // their keys
+    short  offset[KEYS_PER_PAGE];    // slot offsets of a slotted page
+    short  size[KEYS_PER_PAGE];      // slot lengths of a slotted page
+    char*  page;                     // the loaded page, in pageBuf or run
+    char   pageBuf[PageFile::PAGE_SIZE];
+    std::vector<char> run;           // pages read at once in a page range
+    PageId runFirst;                 // the first page in run
+    int    runCount;                 // # pages in run
+    std::string raw;                 // a value read from overflow pages
+    std::string decoded;             // a value decoded with the dictionary
+  };
+
  private:
   PageFile pf;     // the PageFile used to store the records
+  RecordId brid;   // the first record id of the file
   RecordId erid;   // the last record id of the file + 1
+  int      format; // LEGACY_FORMAT, SLOTTED_FORMAT or COLUMNAR_FORMAT
+  ValueDictionary dict; // the values are encoded with it unless it is empty
+
+  // the zone map entry of an extent of ZONE_PAGES pages
+  typedef struct {
+    PageId pid;     // the first page of the extent with records
+    PageId last;    // the last page of the extent with records
+    int    minKey;
+    int    maxKey;
+    int    count;   // # records in the extent
+    int    sorted;  // 1 if the keys ascend in the order of their records
+  } ZoneEntry;
+
+  // the zone map is read lazily, so it is mutable
+  mutable std::vector<ZoneEntry> zones;  // by pid, only extents with records
+  std::string  zoneName;    // the file that keeps the zone map. empty if none
+  mutable bool zonesLoaded; // zones was read or started anew
+  mutable bool zonesValid;  // zones describes every page of the file
+  bool         zonesDirty;  // zones needs to be written
+
+  // the value column of a COLUMNAR_FORMAT file
+  PageFile offsetFile; // (offset, length) of the value of every record
+  PageFile heapFile;   // the bytes of the values
+  int      rowCount;   // # records in the file
+  int      heapSize;   // # bytes in heapFile
+  bool     headerDirty; // the header page needs to be written: rowCount and
+                        // heapSize, or the last data page of a slotted file
+
+  RC appendLegacy(int key, const std::string& value, RecordId& rid);
+  RC appendSlotted(int key, const std::string& value, RecordId& rid);
+  RC appendSlottedBatch(const std::vector<int>& keys, const std::vector<std::string>& values,
+                        std::vector<RecordId>& rids);
+  RC writeOverflow(const std::string& value, PageId& first);
+  RC readOverflow(PageId pid, int length, std::string& value) const;
+  RC openColumns(const std::string& filename, char mode);
+  void noteKey(PageId pid, int key);
+  void loadZones() const;
+  bool readZoneFile() const;
+  RC saveZones();
+  RC appendColumnar(const int* keys, const std::string* values, int count, RecordId* rids);
+  RC readColumnar(const RecordId& rid, int& key, std::string& value) const;
 };
 
 #endif // RECORDFILE_H
@@ -0,0 +1,300 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "ResultSink.h"
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+using std::string;
+
+// the two digits of 00 to 99
+static const char DIGIT_PAIRS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+// the most bytes formatInt() writes
+static const int INT_DIGITS = 20;
+
+/*
+ * write the decimal digits of value, two at a time.
+ * @return # bytes written, at most INT_DIGITS
+ */
+static int formatInt(long long value, char* out)
+{
+  char               digits[INT_DIGITS];
+  char*              p = digits + INT_DIGITS;
+  unsigned long long u = (value < 0) ? 0ULL - (unsigned long long) value : value;
+
+  while (u >= 100) {
+    const char* pair = DIGIT_PAIRS + (u % 100) * 2;
+    u /= 100;
+    *--p = pair[1];
+    *--p = pair[0];
+  }
+  if (u >= 10) {
+    *--p = DIGIT_PAIRS[u * 2 + 1];
+    *--p = DIGIT_PAIRS[u * 2];
+  } else {
+    *--p = '0' + (char) u;
+  }
+
+  int n = 0;
+  if (value < 0) out[n++] = '-';
+  memcpy(out + n, p, digits + INT_DIGITS - p);
+  return n + (digits + INT_DIGITS - p);
+}
+
+BufferedSink::BufferedSink(int fd)
+{
+  buffer = new char[BUFFER_SIZE];
+  used = 0;
+  this->fd = defaultFd = fd;
+  error = 0;
+}
+
+BufferedSink::~BufferedSink()
+{
+  close();
+  delete [] buffer;
+}
+
+RC BufferedSink::open(const string& filename)
+{
+  RC rc;
+
+  if ((rc = close()) < 0) return rc;
+
+  int f = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (f < 0) return RC_FILE_OPEN_FAILED;
+  fd = f;
+  return 0;
+}
+
+RC BufferedSink::close()
+{
+  RC rc = flush();
+
+  if (fd != defaultFd) {
+    if (::close(fd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+    fd = defaultFd;
+  }
+  return rc;
+}
+
+RC BufferedSink::flush()
+{
+  drain();
+
+  RC rc = error;
+  error = 0;
+  return rc;
+}
+
+void BufferedSink::append(const char* data, int length)
+{
+  while (length > 0) {
+    if (used == BUFFER_SIZE) drain();
+    int n = (length < BUFFER_SIZE - used) ? length : BUFFER_SIZE - used;
+    memcpy(buffer + used, data, n);
+    used += n;
+    data += n;
+    length -= n;
+  }
+}
+
+/*
+ * write the buffer to the file descriptor and empty it. a write error is
+ * kept for flush(), and the rows are dropped.
+ */
+void BufferedSink::drain()
+{
+  const char* p = buffer;
+  int         left = used;
+
+  // the shell prompt before the rows is printed through stdio
+  if (fd == STDOUT_FILENO) fflush(stdout);
+
+  while (left > 0) {
+    ssize_t n = ::write(fd, p, left);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      if (error == 0) error = RC_FILE_WRITE_FAILED;
+      break;
+    }
+    p += n;
+    left -= n;
+  }
+  used = 0;
+}
+
+TextSink::TextSink(int fd)
+  : BufferedSink(fd)
+{
+  quote = false;
+  column = 0;
+}
+
+void TextSink::beginRow(int columns)
+{
+  quote = (columns > 1);
+  column = 0;
+}
+
+void TextSink::addInt(long long value)
+{
+  reserve(INT_DIGITS + 1);
+  separate();
+  used += formatInt(value, buffer + used);
+}
+
+void TextSink::addNumber(double value)
+{
+  char text[32];
+  int  n = snprintf(text, sizeof(text), "%.15g", value);
+
+  reserve(n + 1);
+  separate();
+  memcpy(buffer + used, text, n);
+  used += n;
+}
+
+void TextSink::addString(const char* data, int length)
+{
+  reserve(2);
+  separate();
+  if (quote) buffer[used++] = '\'';
+
+  if (length <= BUFFER_SIZE - used) {
+    memcpy(buffer + used, data, length);
+    used += length;
+  } else {
+    append(data, length);
+  }
+
+  if (quote) {
+    reserve(1);
+    buffer[used++] = '\'';
+  }
+}
+
+void TextSink::addNull()
+{
+  reserve(5);
+  separate();
+  memcpy(buffer + used, "NULL", 4);
+  used += 4;
+}
+
+void TextSink::endRow()
+{
+  reserve(1);
+  buffer[used++] = '\n';
+}
+
+BinarySink::BinarySink(int fd)
+  : BufferedSink(fd)
+{
+}
+
+void BinarySink::beginRow(int columns)
+{
+  reserve(sizeof(int));
+  memcpy(buffer + used, &columns, sizeof(int));
+  used += sizeof(int);
+}
+
+void BinarySink::addInt(long long value)
+{
+  reserve(1 + sizeof(long long));
+  buffer[used++] = 'I';
+  memcpy(buffer + used, &value, sizeof(long long));
+  used += sizeof(long long);
+}
+
+void BinarySink::addNumber(double value)
+{
+  reserve(1 + sizeof(double));
+  buffer[used++] = 'D';
+  memcpy(buffer + used, &value, sizeof(double));
+  used += sizeof(double);
+}
+
+void BinarySink::addString(const char* data, int length)
+{
+  reserve(1 + sizeof(int));
+  buffer[used++] = 'S';
+  memcpy(buffer + used, &length, sizeof(int));
+  used += sizeof(int);
+  append(data, length);
+}
+
+void BinarySink::addNull()
+{
+  reserve(1);
+  buffer[used++] = 'N';
+}
+
+CallbackSink::CallbackSink(Callback callback, void* arg)
+{
+  this->callback = callback;
+  this->arg = arg;
+}
+
+void CallbackSink::beginRow(int)
+{
+  row.clear();
+}
+
+ResultColumn& CallbackSink::add(ResultColumn::Type type)
+{
+  // the vectors keep their capacity, so rows are not allocated anew
+  row.resize(row.size() + 1);
+  ResultColumn& c = row.back();
+  c.type = type;
+  c.intValue = 0;
+  c.number = 0;
+  c.data = NULL;
+  c.length = 0;
+  return c;
+}
+
+void CallbackSink::addInt(long long value)
+{
+  add(ResultColumn::INT).intValue = value;
+}
+
+void CallbackSink::addNumber(double value)
+{
+  add(ResultColumn::NUMBER).number = value;
+}
+
+void CallbackSink::addString(const char* data, int length)
+{
+  add(ResultColumn::STRING).length = length;
+  if (strings.size() < row.size()) strings.resize(row.size());
+  strings[row.size() - 1].assign(data, length);
+}
+
+void CallbackSink::addNull()
+{
+  add(ResultColumn::NONE);
+}
+
+void CallbackSink::endRow()
+{
+  // the strings are in place now that the row is complete
+  for (unsigned i = 0; i < row.size(); i++) {
+    if (row[i].type == ResultColumn::STRING) row[i].data = strings[i].data();
+  }
+  callback(row.empty() ? NULL : &row[0], row.size(), arg);
+}
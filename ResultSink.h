@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef RESULTSINK_H
+#define RESULTSINK_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * Receives the rows of a query result, a column at a time: beginRow(),
+ * one add call per column, and endRow(). A sink may hold rows back until
+ * flush(), which the engine calls at the end of every query.
+ */
+class ResultSink {
+ public:
+  virtual ~ResultSink() { }
+
+  /**
+   * start a row.
+   * @param columns[IN] # columns the row has
+   */
+  virtual void beginRow(int columns) = 0;
+
+  /**
+   * add an integer column, such as a key or a count.
+   */
+  virtual void addInt(long long value) = 0;
+
+  /**
+   * add a computed number, such as an average.
+   */
+  virtual void addNumber(double value) = 0;
+
+  /**
+   * add a string column, such as a value. data may be reused after the
+   * call returns.
+   */
+  virtual void addString(const char* data, int length) = 0;
+
+  /**
+   * add a column that has no value, such as the MIN of no rows.
+   */
+  virtual void addNull() = 0;
+
+  /**
+   * end the row.
+   */
+  virtual void endRow() = 0;
+
+  /**
+   * hand the rows held back to their destination.
+   * @return error code. 0 if no error, also for all rows since the
+   * previous flush()
+   */
+  virtual RC flush() = 0;
+};
+
+/**
+ * A sink that collects the rows in a large buffer and writes the buffer
+ * to a file descriptor with write(2) when it is full, without stdio.
+ * The subclasses decide how a row is encoded.
+ */
+class BufferedSink : public ResultSink {
+ public:
+  static const int BUFFER_SIZE = 1 << 20;
+
+  /**
+   * @param fd[IN] the file descriptor the rows are written to
+   */
+  BufferedSink(int fd);
+  ~BufferedSink();
+
+  /**
+   * write the rows to a new file instead, until close().
+   * @param filename[IN] the file to create or truncate
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * flush the rows and close the file opened by open(). the rows are
+   * written to the original file descriptor again.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  RC flush();
+
+ protected:
+  // make room for n bytes at the end of the buffer. n <= BUFFER_SIZE
+  void reserve(int n) { if (used + n > BUFFER_SIZE) drain(); }
+
+  // copy bytes of any length to the buffer
+  void append(const char* data, int length);
+
+  char* buffer;
+  int   used;    // # bytes in buffer
+
+ private:
+  void drain();
+
+  int fd;
+  int defaultFd;   // the fd given to the constructor
+  RC  error;       // the first write error since the last flush()
+};
+
+/**
+ * Writes the rows as text, as the Bruinbase shell prints them: the
+ * columns separated by a space, a line per row, and the strings quoted
+ * when a row has more than one column. Integers are converted to digits
+ * without printf.
+ */
+class TextSink : public BufferedSink {
+ public:
+  TextSink(int fd);
+
+  void beginRow(int columns);
+  void addInt(long long value);
+  void addNumber(double value);
+  void addString(const char* data, int length);
+  void addNull();
+  void endRow();
+
+ private:
+  // a space before every column but the first
+  void separate() { if (column++ > 0) buffer[used++] = ' '; }
+
+  bool quote;    // the row has more than one column
+  int  column;   // # columns added to the row
+};
+
+/**
+ * Writes the rows in a binary stream, in the byte order of the machine:
+ * a row is its # columns as an int, and then every column as a type
+ * byte followed by
+ *   'I': a long long,
+ *   'D': a double,
+ *   'S': the length as an int and the bytes of the string,
+ *   'N': nothing.
+ */
+class BinarySink : public BufferedSink {
+ public:
+  BinarySink(int fd);
+
+  void beginRow(int columns);
+  void addInt(long long value);
+  void addNumber(double value);
+  void addString(const char* data, int length);
+  void addNull();
+  void endRow() { }
+};
+
+/**
+ * a column of a row handed to a CallbackSink
+ */
+struct ResultColumn {
+  enum Type { INT, NUMBER, STRING, NONE } type;
+  long long   intValue;
+  double      number;
+  const char* data;     // of a STRING. valid until the callback returns
+  int         length;
+};
+
+/**
+ * Hands every row to a function, as soon as the row is complete.
+ */
+class CallbackSink : public ResultSink {
+ public:
+  /**
+   * @param columns[IN] the columns of the row
+   * @param count[IN] # columns
+   * @param arg[IN] the argument given to the sink
+   */
+  typedef void (*Callback)(const ResultColumn* columns, int count, void* arg);
+
+  /**
+   * @param callback[IN] called with every row
+   * @param arg[IN] passed to callback
+   */
+  CallbackSink(Callback callback, void* arg);
+
+  void beginRow(int columns);
+  void addInt(long long value);
+  void addNumber(double value);
+  void addString(const char* data, int length);
+  void addNull();
+  void endRow();
+  RC flush() { return 0; }
+
+ private:
+  ResultColumn& add(ResultColumn::Type type);
+
+  Callback                  callback;
+  void*                     arg;
+  std::vector<ResultColumn> row;
+  std::vector<std::string>  strings;   // copies of the strings of row
+};
+
+#endif // RESULTSINK_H
@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "SnapshotFile.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+
+//
+// a snapshot file starts with a header of HEADER_INTS ints:
+// [SNAP_MAGIC][rowCount][sparseCount][keys][sparse][offsets][heap][heapSize]
+// where keys, sparse, offsets and heap are the file offsets of the sections
+//
+static const int SNAP_MAGIC = 0x534e4150;  // "SNAP"
+static const int HEADER_INTS = 8;
+
+// round n up to the next multiple of SnapshotFile::ALIGNMENT
+static long align(long n)
+{
+  return (n + SnapshotFile::ALIGNMENT - 1) / SnapshotFile::ALIGNMENT * SnapshotFile::ALIGNMENT;
+}
+
+// write len bytes at the current position, padded with zeros up to pos
+static RC writePadded(int fd, const void* data, long len, long& written, long pos)
+{
+  static const char zeros[SnapshotFile::ALIGNMENT] = { 0 };
+
+  if (pos > written && ::write(fd, zeros, pos - written) != pos - written) return RC_FILE_WRITE_FAILED;
+  if (len > 0 && ::write(fd, data, len) != len) return RC_FILE_WRITE_FAILED;
+  written = pos + len;
+  return 0;
+}
+
+// orders tuple numbers by their key, keeping equal keys in tuple order
+struct KeyOrder {
+  const vector<int>& keys;
+  KeyOrder(const vector<int>& k) : keys(k) { }
+  bool operator()(int a, int b) const { return keys[a] < keys[b]; }
+};
+
+SnapshotFile::SnapshotFile()
+{
+  base = NULL;
+  size = 0;
+  rowCount = sparseCount = 0;
+  keyArray = sparse = offsets = NULL;
+  heap = NULL;
+}
+
+RC SnapshotFile::write(const string& filename, const vector<int>& keys,
+                       const vector<string>& values)
+{
+  RC  rc = 0;
+  int n = keys.size();
+
+  // put the tuples in key order
+  vector<int> order(n);
+  for (int i = 0; i < n; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), KeyOrder(keys));
+
+  vector<int> sorted(n);
+  vector<int> offsetArray(n + 1);
+  int heapSize = 0;
+  for (int i = 0; i < n; i++) {
+    sorted[i] = keys[order[i]];
+    offsetArray[i] = heapSize;
+    heapSize += values[order[i]].size();
+  }
+  offsetArray[n] = heapSize;
+
+  vector<int> sparseArray;
+  for (int i = 0; i < n; i += STRIDE) sparseArray.push_back(sorted[i]);
+
+  // lay the sections out
+  int header[HEADER_INTS];
+  long keysPos = align(sizeof(header));
+  long sparsePos = align(keysPos + (long) n * sizeof(int));
+  long offsetsPos = align(sparsePos + (long) sparseArray.size() * sizeof(int));
+  long heapPos = align(offsetsPos + (long) (n + 1) * sizeof(int));
+  if (heapPos + heapSize > 0x7fffffffL) return RC_FILE_WRITE_FAILED;
+
+  header[0] = SNAP_MAGIC;
+  header[1] = n;
+  header[2] = sparseArray.size();
+  header[3] = keysPos;
+  header[4] = sparsePos;
+  header[5] = offsetsPos;
+  header[6] = heapPos;
+  header[7] = heapSize;
+
+  string tmpname = filename + ".tmp";
+  int fd = ::open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+
+  long written = 0;
+  if ((rc = writePadded(fd, header, sizeof(header), written, 0)) < 0) goto fail;
+  if (n > 0 && (rc = writePadded(fd, &sorted[0], (long) n * sizeof(int), written, keysPos)) < 0) goto fail;
+  if (!sparseArray.empty() &&
+      (rc = writePadded(fd, &sparseArray[0], (long) sparseArray.size() * sizeof(int), written, sparsePos)) < 0) goto fail;
+  if ((rc = writePadded(fd, &offsetArray[0], (long) (n + 1) * sizeof(int), written, offsetsPos)) < 0) goto fail;
+
+  // the values go to the heap in key order
+  if ((rc = writePadded(fd, NULL, 0, written, heapPos)) < 0) goto fail;
+  for (int i = 0; i < n; i++) {
+    const string& v = values[order[i]];
+    if ((rc = writePadded(fd, v.data(), v.size(), written, written)) < 0) goto fail;
+  }
+
+  if (::close(fd) < 0) {
+    ::remove(tmpname.c_str());
+    return RC_FILE_CLOSE_FAILED;
+  }
+  if (::rename(tmpname.c_str(), filename.c_str()) < 0) {
+    ::remove(tmpname.c_str());
+    return RC_FILE_WRITE_FAILED;
+  }
+  return 0;
+
+  fail:
+  ::close(fd);
+  ::remove(tmpname.c_str());
+  return rc;
+}
+
+RC SnapshotFile::open(const string& filename)
+{
+  struct stat statbuf;
+  int header[HEADER_INTS];
+
+  if (base != NULL) return RC_FILE_OPEN_FAILED;
+
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+  if (::fstat(fd, &statbuf) < 0 || statbuf.st_size < (long) sizeof(header)) {
+    ::close(fd);
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  // the mapping stays valid after the file is closed
+  void* p = ::mmap(NULL, statbuf.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) return RC_FILE_OPEN_FAILED;
+
+  base = (char*) p;
+  size = statbuf.st_size;
+  memcpy(header, base, sizeof(header));
+
+  // check that every section lies inside the file
+  if (header[0] != SNAP_MAGIC || header[1] < 0 || header[2] < 0 || header[7] < 0 ||
+      header[3] + header[1] * (long) sizeof(int) > size ||
+      header[4] + header[2] * (long) sizeof(int) > size ||
+      header[5] + (header[1] + 1) * (long) sizeof(int) > size ||
+      header[6] + (long) header[7] > size) {
+    close();
+    return RC_INVALID_FILE_FORMAT;
+  }
+
+  rowCount = header[1];
+  sparseCount = header[2];
+  keyArray = (const int*) (base + header[3]);
+  sparse = (const int*) (base + header[4]);
+  offsets = (const int*) (base + header[5]);
+  heap = base + header[6];
+
+  return 0;
+}
+
+RC SnapshotFile::close()
+{
+  if (base == NULL) return RC_FILE_CLOSE_FAILED;
+
+  RC rc = (::munmap(base, size) < 0) ? RC_FILE_CLOSE_FAILED : 0;
+  base = NULL;
+  size = 0;
+  rowCount = sparseCount = 0;
+  keyArray = sparse = offsets = NULL;
+  heap = NULL;
+  return rc;
+}
+
+int SnapshotFile::lowerBound(int key) const
+{
+  // the sparse index tells the block of STRIDE keys that has the answer:
+  // the key before the first entry that is key or larger is smaller than key
+  int j = std::lower_bound(sparse, sparse + sparseCount, key) - sparse;
+  int first = (j > 0) ? (j - 1) * STRIDE : 0;
+  int last = (j < sparseCount) ? j * STRIDE : rowCount;
+
+  return std::lower_bound(keyArray + first, keyArray + last, key) - keyArray;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef SNAPSHOTFILE_H
+#define SNAPSHOTFILE_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * An immutable, read-only copy of a table in a single file, written by
+ * "EXPORT SNAPSHOT" and memory-mapped when opened. The file holds
+ *   - a header,
+ *   - the keys of all tuples, sorted, in one dense array,
+ *   - a sparse index: every STRIDE'th key, to find a key with a search
+ *     that touches only a few pages,
+ *   - the start offset of every value in the heap, and
+ *   - the values one after another in a byte heap.
+ * Every section starts at a multiple of ALIGNMENT, so the arrays can be
+ * used in place and the values are returned without copying.
+ */
+class SnapshotFile {
+ public:
+
+  static const int STRIDE = 1024;     // # keys per sparse index entry
+  static const int ALIGNMENT = 64;    // sections start on a cache line
+
+  SnapshotFile();
+
+  /**
+   * write a snapshot of the tuples (keys[i], values[i]) to a file.
+   * the tuples are sorted by key; tuples with equal keys keep their order.
+   * the file is written under a temporary name and renamed, so a reader
+   * never sees it half written.
+   * @param filename[IN] the snapshot file name
+   * @param keys[IN] the keys of the tuples
+   * @param values[IN] the values of the tuples
+   * @return error code. 0 if no error
+   */
+  static RC write(const std::string& filename, const std::vector<int>& keys,
+                  const std::vector<std::string>& values);
+
+  /**
+   * map a snapshot file into memory.
+   * @param filename[IN] the snapshot file name
+   * @return error code. 0 if no error
+   */
+  RC open(const std::string& filename);
+
+  /**
+   * unmap the snapshot file.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return # tuples in the snapshot
+   */
+  int count() const { return rowCount; }
+
+  /**
+   * @return the sorted keys of all tuples, count() of them
+   */
+  const int* keys() const { return keyArray; }
+
+  /**
+   * get the value of the i'th tuple in key order. data points into the
+   * mapped file and stays valid until close().
+   * @param i[IN] the tuple, between 0 and count()-1
+   * @param data[OUT] the first byte of the value
+   * @param length[OUT] # bytes in the value
+   */
+  void value(int i, const char*& data, int& length) const
+  {
+    data = heap + offsets[i];
+    length = offsets[i + 1] - offsets[i];
+  }
+
+  /**
+   * @param key[IN] the key to look for
+   * @return the first tuple whose key is key or larger. count() if none
+   */
+  int lowerBound(int key) const;
+
+ private:
+  char*       base;        // the mapped file
+  long        size;        // # bytes mapped
+  int         rowCount;
+  int         sparseCount; // # entries in sparse
+  const int*  keyArray;    // rowCount sorted keys
+  const int*  sparse;      // keyArray[0], keyArray[STRIDE], ...
+  const int*  offsets;     // rowCount + 1 offsets into heap
+  const char* heap;        // the bytes of the values
+};
+
+#endif // SNAPSHOTFILE_H
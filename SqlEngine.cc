@@ -10,11 +10,18 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
+#include <cmath>
 #include <iostream>
 #include <fstream>
+#include <algorithm>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeIndex.h"
+#include "SnapshotFile.h"
+#include "Predicate.h"
+#include "Operator.h"
 
 using namespace std;
 
@@ -22,6 +29,20 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// # lines of the load file that a COMPRESSED table trains its dictionary on
+static const int DICTIONARY_SAMPLES = 4096;
+
+// # tuples that LOAD appends to the table at a time
+static const int LOAD_BATCH_SIZE = 1024;
+
+// # tuples that a CLUSTERED load sorts in memory at a time
+static const int SORT_RUN_SIZE = 100000;
+
+// the rows of a SELECT are printed on screen unless another sink is set
+static TextSink    screen(STDOUT_FILENO);
+static ResultSink* resultSink = &screen;
+
+
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -35,316 +56,1127 @@ RC SqlEngine::run(FILE* commandline)
   return 0;
 }
 
-RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
+void SqlEngine::setResultSink(ResultSink* sink)
 {
-  RecordFile rf;   // RecordFile containing the table
-  RecordId   rid;  // record cursor for table scanning
+  resultSink = (sink != NULL) ? sink : &screen;
+}
+
+/*
+ * hand the rows of a query that the result sink holds back to their
+ * destination.
+ * @param rc[IN] the result of the query
+ * @return rc, or the error of the sink if rc is 0
+ */
+static RC flushResult(RC rc)
+{
+  RC flushed = resultSink->flush();
+  if (flushed < 0) {
+    fprintf(stderr, "Error: while writing the result\n");
+    if (rc == 0) rc = flushed;
+  }
+  return rc;
+}
+
+/*
+ * estimate the # table pages that reading rows randomly placed records
+ * touches, when an IndexRangeScan reads them FETCH_BATCH_SIZE at a time
+ * in page order and every page of a batch is read once.
+ */
+static int fetchPages(int rows, int tablePages)
+{
+  const int batchSize = IndexRangeScan::FETCH_BATCH_SIZE;
+  double pages = 0;
+
+  for (; rows > 0; rows -= batchSize) {
+    int n = (rows < batchSize) ? rows : batchSize;
+    pages += tablePages * (1 - pow(1 - 1.0 / tablePages, n));
+  }
+  return (int) ceil(pages);
+}
+
+/*
+ * estimate the # page reads of reading the index entries in the key
+ * ranges of a query: a descent and the leaves of every range, and if
+ * fetchRecords is true, one table page per entry.
+ */
+static int indexScanPages(const BTreeIndex& index, const Predicate& pred, bool fetchRecords)
+{
+  int pages = 0;
+  for (int i = 0; i < pred.rangeCount(); i++) {
+    pages += index.estimateScanPages(pred.rangeLow(i), pred.rangeHigh(i), fetchRecords);
+  }
+  return pages;
+}
+
+/*
+ * estimate the # page reads of answering a query on the key ranges of
+ * pred through the index: a descent and the leaves of every range and,
+ * if values are needed, the table pages the matches lie on, or for a
+ * covering index the overflow pages of its long values.
+ * @return the # page reads. -1 if the index has no statistics
+ */
+static int indexPlanPages(const RecordFile& rf, const BTreeIndex& index,
+                          const Predicate& pred, bool needValue)
+{
+  bool fetch = needValue && !index.isCovering();
+
+  if (!index.hasStats()) return -1;
+
+  int tablePages = rf.endRid().pid + 1;
+  int pages = indexScanPages(index, pred, false);
+  int rows = 0;
+  for (int i = 0; i < pred.rangeCount(); i++) {
+    rows += index.estimateRows(pred.rangeLow(i), pred.rangeHigh(i));
+  }
+
+  if (fetch) {
+    if (rf.isClustered()) {
+      // the matches of a range lie on consecutive pages
+      pages += (int) ((double) rows * tablePages / index.getStats().rowCount) + pred.rangeCount();
+    } else {
+      pages += fetchPages(rows, tablePages);
+    }
+  } else if (needValue && index.getPageCount() - 1 > index.getStats().leafCount) {
+    // the long values were stored in load order and are read in key
+    // order, a random read each
+    pages += rows;
+  }
+
+  return pages;
+}
+
+/*
+ * compare the estimated # page reads of answering a query on the key
+ * ranges of pred through the index and with a table scan. the table scan
+ * costs the pages whose zone map overlaps [low, high], so it wins when
+ * the ranges cover most of the table.
+ * @return true if the index scan reads fewer pages
+ */
+static bool indexIsCheaper(const RecordFile& rf, const BTreeIndex& index,
+                           const Predicate& pred, bool needValue)
+{
+  // without statistics only single keys or an index-only scan are
+  // assumed to be cheaper through the index
+  if (!index.hasStats()) {
+    if (!needValue || index.isCovering()) return true;
+    for (int i = 0; i < pred.rangeCount(); i++) {
+      if (pred.rangeLow(i) != pred.rangeHigh(i)) return false;
+    }
+    return true;
+  }
+
+  return indexPlanPages(rf, index, pred, needValue) < rf.pagesInRange(pred.low(), pred.high());
+}
+
+/*
+ * choose how to read the rows of a table that satisfy the key conditions
+ * of pred: through the index if it reads fewer pages than a table scan,
+ * and with a thread per core if the scan is long.
+ * @param index[IN] the open index of the table. NULL if there is none
+ * @param needValue[IN] true if the rows need their values
+ * @param filtered[OUT] true if the scan also applies the value conditions
+ * @param parallel[IN] false if the scan must stop as soon as the rows
+ * asked for are read, so it runs on one thread
+ * @return the scan, to be deleted by the caller
+ */
+static Operator* newScan(const RecordFile& rf, BTreeIndex* index, const Predicate& pred,
+                         bool needValue, bool& filtered, bool parallel = true)
+{
+  filtered = false;
+
+  if (index != NULL && indexIsCheaper(rf, *index, pred, needValue)) {
+    IndexRangeScan::Mode mode = !needValue ? IndexRangeScan::KEYS_ONLY
+                              : index->isCovering() ? IndexRangeScan::COVERING
+                              : IndexRangeScan::FETCH;
+
+    // a long range is split into sub-ranges read by a thread per core
+    int workers = (!parallel || !index->hasStats()) ? 1 :
+      ParallelScan::workersFor(indexScanPages(*index, pred, mode == IndexRangeScan::FETCH));
+    if (workers > 1) {
+      filtered = true;
+      return new ParallelIndexScan(*index, rf, pred, mode, workers);
+    }
+    return new IndexRangeScan(*index, rf, pred, mode);
+  }
+
+  // a table scan of more than a morsel of pages runs on a thread per core
+  int workers = ParallelScan::workersFor(rf.pagesInRange(pred.low(), pred.high()));
+  if (parallel && workers > 1) {
+    filtered = true;
+    return new ParallelTableScan(rf, pred, needValue, workers);
+  }
+  return new TableScan(rf, pred, needValue);
+}
+
+/*
+ * guess the fraction of rows that pass the conditions on the value, for
+ * which there are no statistics: a tenth for an equality, a third for a
+ * range and all rows for <>. the fractions of the disjuncts of an OR
+ * add up.
+ */
+static double valueSelectivity(const vector<vector<SelCond> >& cond)
+{
+  double total = 0;
+  for (unsigned d = 0; d < cond.size(); d++) {
+    double fraction = 1;
+    for (unsigned i = 0; i < cond[d].size(); i++) {
+      if (cond[d][i].attr != 2) continue;
+      if (cond[d][i].comp == SelCond::EQ) fraction /= 10;
+      else if (cond[d][i].comp != SelCond::NE) fraction /= 3;
+    }
+    total += fraction;
+  }
+  return min(total, 1.0);
+}
+
+/*
+ * compare the estimated # page reads of reading the rows of a query in
+ * key order through the index, stopping after limit rows pass the value
+ * conditions, and of the cheaper of an index and a table scan that reads
+ * all rows of the key ranges. the ordered scan reads a record as soon as
+ * its entry is read, a random read each if the table is not clustered.
+ * as the fraction of rows that pass the value conditions is a guess, a
+ * scan with random reads is assumed to read all rows of the ranges when
+ * there are value conditions.
+ * @param selectivity[IN] the guessed fraction of the rows that pass the
+ * conditions on the value
+ * @param limit[IN] # rows needed. -1 for all rows
+ * @return true if the ordered index scan reads fewer pages
+ */
+static bool orderedIndexIsCheaper(const RecordFile& rf, const BTreeIndex& index,
+                                  const Predicate& pred, bool needValue,
+                                  double selectivity, int limit)
+{
+  // without statistics the first rows are found at once, unless rows
+  // may be skipped
+  if (!index.hasStats()) {
+    if (limit >= 0 && !pred.needsValue()) return true;
+    return indexIsCheaper(rf, index, pred, needValue);
+  }
+
+  const IndexStats& stats = index.getStats();
+  int tablePages = rf.endRid().pid + 1;
+  bool randomReads = needValue && (index.isCovering() ? index.getPageCount() - 1 > stats.leafCount
+                                                      : !rf.isClustered());
+  int total = 0;
+  for (int i = 0; i < pred.rangeCount(); i++) {
+    total += index.estimateRows(pred.rangeLow(i), pred.rangeHigh(i));
+  }
+
+  // the rows read until limit of them pass
+  int rows = total;
+  if (limit >= 0 && (!pred.needsValue() || (!randomReads && selectivity > 0))) {
+    rows = (int) min((double) total, ceil(limit / (pred.needsValue() ? selectivity : 1.0)));
+  }
+  double part = (total > 0) ? (double) rows / total : 0;
+
+  int pages = max(1, (int) ceil(indexScanPages(index, pred, false) * part));
+  if (randomReads) {
+    pages += rows;
+  } else if (needValue && !index.isCovering()) {
+    pages += (int) ((double) rows * tablePages / max(stats.rowCount, 1)) + 1;
+  }
+
+  int unordered = rf.pagesInRange(pred.low(), pred.high());
+  if (indexIsCheaper(rf, index, pred, needValue)) {
+    unordered = indexPlanPages(rf, index, pred, needValue);
+  }
+  return pages <= unordered;
+}
+
+/*
+ * @return true if the key conditions only allow single keys that the
+ * Bloom filter of the index has never seen
+ */
+static bool bloomRulesOut(const BTreeIndex& index, const Predicate& pred)
+{
+  for (int i = 0; i < pred.rangeCount(); i++) {
+    if (pred.rangeLow(i) != pred.rangeHigh(i) || index.mayContain(pred.rangeLow(i))) return false;
+  }
+  return true;
+}
+
+/*
+ * @return the attribute that a SELECT list without aggregates prints, as
+ * 1: key, 2: value, 3: *, or 4 for count(*) alone. 0 if the list is
+ * computed by an Aggregate.
+ */
+static int plainAttr(const vector<SelItem>& items, int groupBy)
+{
+  if (groupBy != 0 || items.size() != 1) return 0;
+  if (items[0].func == SelItem::NONE) return items[0].attr;
+  if (items[0].func == SelItem::COUNT) return 4;
+  return 0;
+}
+
+/*
+ * check that every attribute of a SELECT list other than the aggregates
+ * is the GROUP BY attribute, or the only item of the list.
+ * @return error code. 0 if no error
+ */
+static RC checkItems(const vector<SelItem>& items, int groupBy)
+{
+  for (unsigned i = 0; i < items.size(); i++) {
+    if (items[i].func != SelItem::NONE) continue;
+    if (groupBy == 0 && items.size() > 1) {
+      fprintf(stderr, "Error: an attribute cannot be selected together with other items\n");
+      return RC_INVALID_ATTRIBUTE;
+    }
+    if (groupBy != 0 && items[i].attr != groupBy) {
+      fprintf(stderr, "Error: only the GROUP BY attribute can be selected with aggregates\n");
+      return RC_INVALID_ATTRIBUTE;
+    }
+  }
+  return 0;
+}
+
+/*
+ * @return the side of a join that a qualified attribute belongs to: 0 for
+ * the left table, 1 for the right one and -1 for any other table
+ */
+static int tableSide(const char* name, const string& left, const string& right)
+{
+  if (left == name) return 0;
+  if (right == name) return 1;
+  return -1;
+}
+
+/*
+ * @return the table of a join whose value the conditions of an OR group
+ * test, 0 for the left and 1 for the right, or 2 if they only test the
+ * key. -1 if they test the values of both tables or an unqualified
+ * value, compare attributes or name a table that is not joined
+ */
+static int groupSide(const vector<vector<SelCond> >& group, const string& left,
+                     const string& right)
+{
+  int side = 2;
+  for (unsigned d = 0; d < group.size(); d++) {
+    for (unsigned i = 0; i < group[d].size(); i++) {
+      const SelCond& c = group[d][i];
+      int s;
+      if (c.group != NULL) s = groupSide(*c.group, left, right);
+      else if (c.value == NULL) s = -1;
+      else if (c.table != NULL && tableSide(c.table, left, right) < 0) s = -1;
+      else if (c.attr == 1) s = 2;
+      else s = (c.table == NULL) ? -1 : tableSide(c.table, left, right);
+
+      if (s < 0 || (s != 2 && side != 2 && s != side)) return -1;
+      if (s != 2) side = s;
+    }
+  }
+  return side;
+}
+
+/*
+ * @return true if every disjunct has a condition that is the same as c,
+ * as the conditions ANDed with an OR or an IN list do
+ */
+static bool inEveryDisjunct(const SelCond& c, const vector<vector<SelCond> >& cond)
+{
+  for (unsigned d = 0; d < cond.size(); d++) {
+    bool found = false;
+    for (unsigned i = 0; i < cond[d].size() && !found; i++) {
+      const SelCond& o = cond[d][i];
+      found = o.attr == c.attr && o.comp == c.comp && o.value != NULL
+        && strcmp(o.value, c.value) == 0
+        && (o.table == NULL ? c.table == NULL : c.table != NULL && strcmp(o.table, c.table) == 0);
+    }
+    if (!found) return false;
+  }
+  return true;
+}
+
+/*
+ * check that every qualified attribute of the conditions of a
+ * single-table query, and of their OR groups, is on the table, and that
+ * every condition compares with a value.
+ * @return error code. 0 if no error
+ */
+static RC checkConds(const string& table, const vector<vector<SelCond> >& cond)
+{
+  RC rc;
+
+  for (unsigned i = 0; i < cond.size(); i++) {
+    for (unsigned j = 0; j < cond[i].size(); j++) {
+      const SelCond& c = cond[i][j];
+      if (c.group != NULL) {
+        if ((rc = checkConds(table, *c.group)) < 0) return rc;
+        continue;
+      }
+      const char* other = (c.table != NULL && table != c.table) ? c.table
+                        : (c.otherTable != NULL && table != c.otherTable) ? c.otherTable : NULL;
+      if (other != NULL) {
+        fprintf(stderr, "Error: table %s is not in the FROM clause\n", other);
+        return RC_INVALID_ATTRIBUTE;
+      }
+      if (c.value == NULL) {
+        fprintf(stderr, "Error: attributes can only be compared in a join\n");
+        return RC_INVALID_ATTRIBUTE;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+ * check that every qualified attribute of a single-table query is on the
+ * table, and that every condition compares with a value.
+ * @return error code. 0 if no error
+ */
+static RC checkTable(const vector<SelItem>& items, const string& table,
+                     const vector<vector<SelCond> >& cond)
+{
+  for (unsigned i = 0; i < items.size(); i++) {
+    if (items[i].table != NULL && table != items[i].table) {
+      fprintf(stderr, "Error: table %s is not in the FROM clause\n", items[i].table);
+      return RC_INVALID_ATTRIBUTE;
+    }
+  }
+  return checkConds(table, cond);
+}
+
+/*
+ * @return true if the SELECT list is only MIN(key) and MAX(key)
+ */
+static bool onlyKeyBounds(const vector<SelItem>& items, int groupBy)
+{
+  if (groupBy != 0) return false;
+  for (unsigned i = 0; i < items.size(); i++) {
+    if (items[i].attr != 1) return false;
+    if (items[i].func != SelItem::MIN && items[i].func != SelItem::MAX) return false;
+  }
+  return true;
+}
+
+/*
+ * the scan of a query that no row can satisfy.
+ */
+class EmptyScan : public Operator {
+ public:
+  RC next(RowBatch&) { return RC_END_OF_FILE; }
+};
+
+/*
+ * run a query plan on top of its scan: the scan applies the conditions on
+ * the key, a Filter the conditions on the value, a Sort orders the rows
+ * when the scan does not return them in the order of ORDER BY, a Count
+ * answers "select count(*)", a Limit stops the plan after LIMIT rows, and
+ * the Output prints the rows. any other list of aggregates, and GROUP BY,
+ * is computed by an Aggregate instead.
+ * @param scan[IN] the scan of the table
+ * @param items[IN] the items of the SELECT clause
+ * @param groupBy[IN] the GROUP BY attribute as in select()
+ * @param pred[IN] the conditions of the query
+ * @param order[IN] the ORDER BY and LIMIT clauses
+ * @param keyOrder[IN] true if the scan returns the rows in key order
+ * @param filter[IN] false if the scan applies the value conditions itself
+ * @return error code. 0 if no error
+ */
+static RC runPlan(Operator* scan, const vector<SelItem>& items, int groupBy,
+                  const Predicate& pred, const SelOrder& order, bool keyOrder,
+                  bool filter = true)
+{
+  Operator* top = scan;
+  int       attr = plainAttr(items, groupBy);
+
+  Filter valueFilter(top, pred);
+  if (filter && pred.needsValue()) top = &valueFilter;
+
+  if (attr == 0) {
+    return Aggregate(top, items, groupBy, *resultSink, order.limit).run();
+  }
+
+  // a count is a single row, so only LIMIT 0 changes it
+  Count count(top);
+  if (attr == 4) top = &count;
+
+  Sort sort(top, order.descending, order.limit);
+  if (attr != 4 && order.attr != 0 && (!keyOrder || order.descending)) top = &sort;
+
+  Limit limit(top, order.limit);
+  if (order.limit == 0 || (order.limit > 0 && attr != 4)) top = &limit;
+
+  return Output(top, (attr == 4) ? Output::KEY : attr, *resultSink).run();
+}
 
+RC SqlEngine::select(const vector<SelItem>& items, const string& table,
+                     const vector<vector<SelCond> >& cond, int groupBy,
+                     const SelOrder& order)
+{
+  RecordFile rf;   // RecordFile containing the table
   BTreeIndex index;
-  RC     rc;
-  int    key;
-  string value;
-  int    count;
-  int    diff;
+  RC         rc;
+
+  if ((rc = checkItems(items, groupBy)) < 0 || (rc = checkTable(items, table, cond)) < 0) {
+    return rc;
+  }
+  if (order.attr != 0 && groupBy != 0) {
+    fprintf(stderr, "Error: ORDER BY is not supported with GROUP BY\n");
+    return RC_INVALID_ATTRIBUTE;
+  }
+
+  // the conditions, compiled once for all tuples
+  Predicate pred(cond);
+
+  bool needValue = pred.needsValue() || groupBy == 2;
+  for (unsigned i = 0; i < items.size(); i++) {
+    if (items[i].attr == 2 || (items[i].attr == 3 && items[i].func == SelItem::NONE)) {
+      needValue = true;
+    }
+  }
+
+  // a snapshot of the table answers the query without opening the table
+  SnapshotFile snap;
+  if (snap.open(table + ".snap") == 0) {
+    SnapshotScan snapScan(snap, pred, needValue);
+    rc = runPlan(&snapScan, items, groupBy, pred, order, true);
+    snap.close();
+    return flushResult(rc);
+  }
+
+  bool indexOpened = (index.open(table + ".idx", 'r') == 0);
+
+  // a key that the Bloom filter has never seen matches nothing.
+  // this costs the meta page and one filter page of the index, and the
+  // table file is not even opened.
+  if (indexOpened && (pred.empty() || bloomRulesOut(index, pred))) {
+    EmptyScan emptyScan;
+    rc = flushResult(runPlan(&emptyScan, items, groupBy, pred, order, true));
+    index.close();
+    return rc;
+  }
 
   // open the table file
   if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    if (indexOpened) index.close();
     return rc;
   }
 
-  rid.pid = rid.sid = 0;
-  count = 0;
+  if (pred.empty()) {
+    EmptyScan emptyScan;
+    rc = runPlan(&emptyScan, items, groupBy, pred, order, true);
+  }
+  // MIN(key) and MAX(key) are the ends of the range, a descent each
+  else if (indexOpened && onlyKeyBounds(items, groupBy) && !needValue && !pred.hasExclusions()) {
+    KeyBoundsScan boundsScan(index, pred);
+    rc = runPlan(&boundsScan, items, groupBy, pred, order, true);
+  }
+  // ascending key order is the order of the index. the scan stops after
+  // LIMIT rows if it reads fewer pages than a scan of all rows.
+  else if (indexOpened && order.attr == 1 && !order.descending
+           && orderedIndexIsCheaper(rf, index, pred, needValue, valueSelectivity(cond), order.limit)) {
+    IndexRangeScan::Mode mode = !needValue ? IndexRangeScan::KEYS_ONLY
+                              : index.isCovering() ? IndexRangeScan::COVERING
+                              : IndexRangeScan::FETCH;
+    IndexRangeScan scan(index, rf, pred, mode, true);
+    rc = runPlan(&scan, items, groupBy, pred, order, true);
+  }
+  else {
+    // a LIMIT without ORDER BY stops a scan on one thread early
+    bool      filtered;
+    bool      parallel = (order.attr != 0 || order.limit < 0);
+    Operator* scan = newScan(rf, indexOpened ? &index : NULL, pred, needValue, filtered, parallel);
+    rc = runPlan(scan, items, groupBy, pred, order, false, !filtered);
+    delete scan;
+  }
 
-  bool hasVal = false;
-  int min = -1;
-  int max = -1;
-  int findKey = -1;
-  bool isNE = false;
-  bool condEQ = false;
-  bool indexOpened = false;
+  if (rc < 0) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+  }
+  rc = flushResult(rc);
 
-  // Determine our conditions (so can choose to use index or table)
-  for (unsigned i = 0; i < cond.size(); i++) {
-    if (cond[i].attr == 2) {
-      hasVal = true;
+  // close the table file and return
+  rf.close();
+  if (indexOpened) {
+    index.close();
+  }
+  return rc;
+}
+
+/*
+ * the operators that read one table of a join: its scan, and a Filter if
+ * the scan does not apply the value conditions itself.
+ */
+class JoinInput {
+ public:
+  JoinInput() : scan(NULL), filter(NULL) { }
+  ~JoinInput() { delete filter; delete scan; }
+
+  /*
+   * take over a scan of the table.
+   * @param filtered[IN] true if the scan applies the value conditions
+   * @return the operator that returns the rows of the table
+   */
+  Operator* read(Operator* scan, bool filtered, const Predicate& pred)
+  {
+    this->scan = scan;
+    if (filtered || !pred.needsValue()) return scan;
+    filter = new Filter(scan, pred);
+    return filter;
+  }
+
+ private:
+  Operator* scan;
+  Filter*   filter;
+};
+
+/*
+ * @return true if an index scan of the table returns its rows in key
+ * order: the index is read alone or with a covering value, or the table
+ * is stored in key order.
+ */
+static bool scansInKeyOrder(const RecordFile& rf, const BTreeIndex& index, bool needValue)
+{
+  return !needValue || index.isCovering() || rf.isClustered();
+}
+
+/*
+ * choose the cheapest strategy to join two tables on their keys, and
+ * run it. the estimated # page reads of the strategies are
+ *   hash join:        the scans of both tables
+ *   merge join:       the index scans of both tables
+ *   index nested-loop join: the scan of the outer table, and a lookup
+ *                     in the index of the inner table per outer row
+ * without statistics the merge join is chosen when both indexes return
+ * the rows in key order, and the hash join otherwise.
+ * @param rf[IN] the open left and right tables
+ * @param index[IN] their open indexes. NULL if a table has none
+ * @param pred[IN] the conditions on the left and right tables
+ * @param needValue[IN] true if the values of a table are needed
+ * @param selectivity[IN] the guessed fraction of the rows of a table in
+ * the key range that pass its conditions on the value
+ * @return error code. 0 if no error
+ */
+static RC runJoin(RecordFile* rf, BTreeIndex** index, const Predicate** pred,
+                  const bool* needValue, const double* selectivity, JoinOutput& out)
+{
+  enum { HASH, MERGE, NESTED_LOOP } strategy = HASH;
+  int       outer = 0;           // the outer side of a nested-loop join
+  bool      haveStats = true;    // true if both tables have index statistics
+  int       tablePages[2], scanPages[2], rows[2];
+  JoinInput input[2];
+
+  for (int i = 0; i < 2; i++) {
+    tablePages[i] = rf[i].pagesInRange(pred[i]->low(), pred[i]->high());
+    scanPages[i] = tablePages[i];
+    rows[i] = -1;
+    if (index[i] != NULL && index[i]->hasStats()) {
+      if (indexIsCheaper(rf[i], *index[i], *pred[i], needValue[i])) {
+        scanPages[i] = indexPlanPages(rf[i], *index[i], *pred[i], needValue[i]);
+      }
+      rows[i] = 0;
+      for (int r = 0; r < pred[i]->rangeCount(); r++) {
+        rows[i] += index[i]->estimateRows(pred[i]->rangeLow(r), pred[i]->rangeHigh(r));
+      }
+    } else {
+      haveStats = false;
     }
+  }
 
-    int val = atoi(cond[i].value);
-    switch (cond[i].comp) {
-      case SelCond::EQ:
-        findKey = atoi(cond[i].value);
-        break;
-      case SelCond::NE:
-        isNE = true;
-        break;
-      case SelCond::LT:
-        if (max == -1 || val > max)
-          max = val;
-        break;
-      case SelCond::LE:
-        if (max == -1 || val > max) {
-          max = val;
-          condEQ = true;
-        }
-        break;
-      case SelCond::GT:
-        if (min == -1 || val < min)
-          min = val;
-        break;
-      case SelCond::GE:
-        if (min == -1 || val < min) {
-          min = val;
-          condEQ = true;
-        }
-        break;
-      default:
-        break;
+  bool canMerge = index[0] != NULL && index[1] != NULL
+    && scansInKeyOrder(rf[0], *index[0], needValue[0])
+    && scansInKeyOrder(rf[1], *index[1], needValue[1]);
+
+  if (haveStats) {
+    int cost = scanPages[0] + scanPages[1];
+    if (canMerge) {
+      int mergeCost = indexPlanPages(rf[0], *index[0], *pred[0], needValue[0])
+                    + indexPlanPages(rf[1], *index[1], *pred[1], needValue[1]);
+      if (mergeCost <= cost) {
+        strategy = MERGE;
+        cost = mergeCost;
+      }
+    }
+    // the keys are looked up in key order, so the nodes above the leaves
+    // stay in the page cache, and no leaf of the inner range is read
+    // twice. the values of the rows of a key are read from the inner
+    // table, on one page if it is clustered, or from the overflow pages
+    // of a covering index with long values.
+    for (int o = 0; o < 2; o++) {
+      int i = 1 - o;
+      const IndexStats& stats = index[i]->getStats();
+      double rowsPerKey = (double) stats.rowCount / max(stats.distinctKeys, 1);
+      int lookups = (int) ceil(rows[o] * selectivity[o]);
+      int matches = (int) min((double) rows[i], lookups * rowsPerKey);
+      int valuePages = 0;
+      if (needValue[i] && !index[i]->isCovering()) {
+        valuePages = rf[i].isClustered() ? min(lookups, tablePages[i]) : matches;
+      } else if (needValue[i] && index[i]->getPageCount() - 1 > stats.leafCount) {
+        valuePages = matches;
+      }
+      int lookupCost = scanPages[o] + min(lookups, indexScanPages(*index[i], *pred[i], false))
+                     + valuePages;
+      if (lookupCost < cost) {
+        strategy = NESTED_LOOP;
+        outer = o;
+        cost = lookupCost;
+      }
     }
+  } else if (canMerge) {
+    strategy = MERGE;
   }
 
-  string idx_file = table + ".idx";
-  rc = index.open(idx_file.c_str(), 'r');
+  if (strategy == MERGE) {
+    Operator* side[2];
+    for (int i = 0; i < 2; i++) {
+      IndexRangeScan::Mode mode = !needValue[i] ? IndexRangeScan::KEYS_ONLY
+                                : index[i]->isCovering() ? IndexRangeScan::COVERING
+                                : IndexRangeScan::FETCH;
+      // a clustered table has its pages in key order, but not the rows
+      // within a page, so the records are read in the order of the index
+      side[i] = input[i].read(new IndexRangeScan(*index[i], rf[i], *pred[i], mode, true),
+                              false, *pred[i]);
+    }
+    return MergeJoin(side[0], side[1]).run(out);
+  }
 
-  // Check if conditions are possible
-  if (min > max && max != -1 && min != -1) {
-    goto exit_to_print;
+  if (strategy == NESTED_LOOP) {
+    int  inner = 1 - outer;
+    bool filtered;
+    Operator* scan = newScan(rf[outer], index[outer], *pred[outer], needValue[outer], filtered);
+    return IndexNestedLoopJoin(input[outer].read(scan, filtered, *pred[outer]), *index[inner],
+                               rf[inner], *pred[inner], needValue[inner], outer == 0).run(out);
   }
-  if (min == max && !condEQ && max != -1 && min != -1) {
-    goto exit_to_print;
+
+  // the side with fewer rows, or fewer pages, is kept in the hash table
+  int build = (rows[0] >= 0 && rows[1] >= 0) ? (rows[1] * selectivity[1] < rows[0] * selectivity[0])
+                                             : (scanPages[1] < scanPages[0]);
+  Operator* side[2];
+  for (int i = 0; i < 2; i++) {
+    bool filtered;
+    Operator* scan = newScan(rf[i], index[i], *pred[i], needValue[i], filtered);
+    side[i] = input[i].read(scan, filtered, *pred[i]);
   }
+  return HashJoin(side[build], side[1 - build], build == 0).run(out);
+}
 
-  /* DON'T use index tree when:
-    1. Index tree doesn't exist
-    2. Not Equal condition on key
-  */
+RC SqlEngine::join(const vector<SelItem>& items, const string& left,
+                   const string& right, const vector<vector<SelCond> >& cond,
+                   int limit)
+{
+  RecordFile  rf[2];
+  BTreeIndex  index[2];
+  BTreeIndex* indexOpened[2] = { NULL, NULL };
+  string      table[2] = { left, right };
+  vector<vector<SelCond> > sideCond[2];
+  vector<int> columns;
+  bool        needValue[2] = { false, false };
+  RC          rc;
 
-  if (rc != 0 || (isNE && !hasVal)) {
-    // Use table
+  // the columns of the SELECT clause
+  for (unsigned i = 0; i < items.size(); i++) {
+    const SelItem& item = items[i];
+    int side = (item.table == NULL) ? 2 : tableSide(item.table, left, right);
+    if (side < 0) {
+      fprintf(stderr, "Error: table %s is not in the FROM clause\n", item.table);
+      return RC_INVALID_ATTRIBUTE;
+    }
+    if (item.func == SelItem::COUNT && item.attr == 3 && items.size() == 1) break;
+    if (item.func != SelItem::NONE) {
+      fprintf(stderr, "Error: only count(*) is supported in a join\n");
+      return RC_INVALID_ATTRIBUTE;
+    }
+    if (item.attr == 1) {
+      columns.push_back(JoinOutput::KEY);
+    } else if (item.attr == 3) {
+      columns.push_back(JoinOutput::KEY);
+      columns.push_back(JoinOutput::LEFT_VALUE);
+      columns.push_back(JoinOutput::RIGHT_VALUE);
+      needValue[0] = needValue[1] = true;
+    } else if (side == 2) {
+      fprintf(stderr, "Error: value is ambiguous in a join\n");
+      return RC_INVALID_ATTRIBUTE;
+    } else {
+      columns.push_back(side == 0 ? JoinOutput::LEFT_VALUE : JoinOutput::RIGHT_VALUE);
+      needValue[side] = true;
+    }
+  }
 
-    // scan the table file from the beginning
-    while (rid < rf.endRid()) {
-      // read the tuple
-      if ((rc = rf.read(rid, key, value)) < 0) {
-        fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-        goto exit_select;
-      }
+  // a condition on the key applies to both tables, one on the value to
+  // its own table. every disjunct of an OR has to join the tables, and
+  // apart from the conditions ANDed with the whole OR only the value of
+  // one table can be tested, so that the disjuncts of that table select
+  // exactly its rows, and those of the other table keep all rows whose
+  // keys can match.
+  int  valueSide = -1;            // the table whose value is tested. -1 if none
+  bool joined = !cond.empty();    // true if every disjunct joins the tables
+  sideCond[0].resize(cond.size());
+  sideCond[1].resize(cond.size());
+  for (unsigned d = 0; d < cond.size(); d++) {
+    bool joins = false;
+    for (unsigned i = 0; i < cond[d].size(); i++) {
+      const SelCond& c = cond[d][i];
 
-      // check the conditions on the tuple
-      for (unsigned i = 0; i < cond.size(); i++) {
-        // compute the difference between the tuple value and the condition value
-        switch (cond[i].attr) {
-        case 1:
-          diff = key - atoi(cond[i].value);
-          break;
-        case 2:
-          diff = strcmp(value.c_str(), cond[i].value);
-          break;
-        default: break;
+      // an OR group goes with the key conditions, or with the table
+      // whose value it tests
+      if (c.group != NULL) {
+        int side = groupSide(*c.group, left, right);
+        if (side < 0) {
+          fprintf(stderr, "Error: an OR in a join can only test the key and the value of one table\n");
+          return RC_INVALID_ATTRIBUTE;
         }
+        if (side == 2) {
+          sideCond[0][d].push_back(c);
+          sideCond[1][d].push_back(c);
+          continue;
+        }
+        // ANDed with the whole WHERE clause, it is like a plain condition
+        if (cond.size() > 1) {
+          if (valueSide >= 0 && valueSide != side) {
+            fprintf(stderr, "Error: OR in a join can only test the value of one table\n");
+            return RC_INVALID_ATTRIBUTE;
+          }
+          valueSide = side;
+        }
+        sideCond[side][d].push_back(c);
+        continue;
+      }
 
-        // skip the tuple if any condition is not met
-        switch (cond[i].comp) {
-        case SelCond::EQ:
-          if (diff != 0) goto next_tuple;
-          break;
-        case SelCond::NE:
-          if (diff == 0) goto next_tuple;
-          break;
-        case SelCond::GT:
-          if (diff <= 0) goto next_tuple;
-          break;
-        case SelCond::LT:
-          if (diff >= 0) goto next_tuple;
-          break;
-        case SelCond::GE:
-          if (diff < 0) goto next_tuple;
-          break;
-        case SelCond::LE:
-          if (diff > 0) goto next_tuple;
-          break;
-        default:
-          break;
+      int side = (c.table == NULL) ? 2 : tableSide(c.table, left, right);
+      if (side < 0) {
+        fprintf(stderr, "Error: table %s is not in the FROM clause\n", c.table);
+        return RC_INVALID_ATTRIBUTE;
+      }
+      if (c.value == NULL) {
+        int otherSide = (c.otherTable == NULL) ? 2 : tableSide(c.otherTable, left, right);
+        if (c.attr != 1 || c.otherAttr != 1 || side + otherSide != 1) {
+          fprintf(stderr, "Error: tables can only be joined on %s.key = %s.key\n",
+                  left.c_str(), right.c_str());
+          return RC_INVALID_ATTRIBUTE;
+        }
+        joins = true;
+      } else if (c.attr == 1) {
+        sideCond[0][d].push_back(c);
+        sideCond[1][d].push_back(c);
+      } else if (side == 2) {
+        fprintf(stderr, "Error: value is ambiguous in a join\n");
+        return RC_INVALID_ATTRIBUTE;
+      } else {
+        if (!inEveryDisjunct(c, cond) && valueSide >= 0 && valueSide != side) {
+          fprintf(stderr, "Error: OR in a join can only test the value of one table\n");
+          return RC_INVALID_ATTRIBUTE;
         }
+        if (!inEveryDisjunct(c, cond)) valueSide = side;
+        sideCond[side][d].push_back(c);
       }
+    }
+    joined = joined && joins;
+  }
+  if (!joined) {
+    fprintf(stderr, "Error: a join needs the condition %s.key = %s.key\n",
+            left.c_str(), right.c_str());
+    return RC_INVALID_ATTRIBUTE;
+  }
+
+  // open the table files and their indexes
+  for (int i = 0; i < 2; i++) {
+    if ((rc = rf[i].open(table[i] + ".tbl", 'r')) < 0) {
+      fprintf(stderr, "Error: table %s does not exist\n", table[i].c_str());
+      if (i == 1) rf[0].close();
+      if (indexOpened[0] != NULL) index[0].close();
+      return rc;
+    }
+    if (index[i].open(table[i] + ".idx", 'r') == 0) {
+      indexOpened[i] = &index[i];
+    }
+  }
 
-      // the condition is met for the tuple.
-      // increase matching tuple counter
-      count++;
+  // only the keys of both tables join, so the key range of each table
+  // is narrowed to the keys of the other
+  char bound[2][16];
+  if (indexOpened[0] != NULL && indexOpened[1] != NULL
+      && index[0].hasStats() && index[1].hasStats()) {
+    const IndexStats& a = index[0].getStats();
+    const IndexStats& b = index[1].getStats();
+    if (a.rowCount == 0 || b.rowCount == 0) {
+      sprintf(bound[0], "%d", 1);
+      sprintf(bound[1], "%d", 0);
+    } else {
+      sprintf(bound[0], "%d", max(a.minKey, b.minKey));
+      sprintf(bound[1], "%d", min(a.maxKey, b.maxKey));
+    }
 
-      // print the tuple
-      switch (attr) {
-      case 1:  // SELECT key
-        fprintf(stdout, "%d\n", key);
-        break;
-      case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
-        break;
-      case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
-        break;
+    SelCond c;
+    c.attr = 1;
+    c.table = c.otherTable = NULL;
+    c.otherAttr = 0;
+    c.group = NULL;
+    for (int i = 0; i < 2; i++) {
+      c.comp = (i == 0) ? SelCond::GE : SelCond::LE;
+      c.value = bound[i];
+      for (unsigned d = 0; d < cond.size(); d++) {
+        sideCond[0][d].push_back(c);
+        sideCond[1][d].push_back(c);
       }
+    }
+  }
+
+  // the conditions of each table, compiled once for all tuples
+  Predicate leftPred(sideCond[0]);
+  Predicate rightPred(sideCond[1]);
+  const Predicate* pred[2] = { &leftPred, &rightPred };
+  for (int i = 0; i < 2; i++) {
+    needValue[i] = needValue[i] || pred[i]->needsValue();
+  }
+
+  JoinOutput out(columns, *resultSink, limit);
 
-      // move to the next tuple
-      next_tuple:
-      ++rid;
+  // a key that the Bloom filter of either table has never seen matches nothing
+  rc = 0;
+  if (!leftPred.empty() && !rightPred.empty()
+      && (indexOpened[0] == NULL || !bloomRulesOut(index[0], leftPred))
+      && (indexOpened[1] == NULL || !bloomRulesOut(index[1], rightPred))) {
+    double selectivity[2] = { valueSelectivity(sideCond[0]), valueSelectivity(sideCond[1]) };
+    rc = runJoin(rf, indexOpened, pred, needValue, selectivity, out);
+  }
+  if (rc == 0) {
+    out.finish();
+  } else {
+    fprintf(stderr, "Error: while reading a tuple from table %s or %s\n",
+            left.c_str(), right.c_str());
+  }
+  rc = flushResult(rc);
+
+  // close the table files and return
+  for (int i = 0; i < 2; i++) {
+    rf[i].close();
+    if (indexOpened[i] != NULL) {
+      index[i].close();
     }
   }
-  else {
-    // Use index
-    IndexCursor cursor;
-    indexOpened = true;
+  return rc;
+}
+
+/*
+ * append tuples to the table and insert them into its index.
+ * @param idx[IN] the index of the table. NULL if it has none
+ * @return error code. 0 if no error
+ */
+static RC appendTuples(RecordFile& rf, BTreeIndex* idx, const vector<int>& keys,
+                       const vector<string>& values, const string& table)
+{
+  RC rc;
+  vector<RecordId> rids;
 
-    if (findKey != -1 && !hasVal) {
-      index.locate(findKey, cursor); // returns set cursor
+  if ((rc = rf.appendBatch(keys, values, rids)) < 0) {
+    fprintf(stderr, "Error: while writing tuples to table %s\n", table.c_str());
+    return rc;
+  }
+
+  // If index is true, insert corresponding tuple into B+Tree Index
+  if (idx != NULL) {
+    for (unsigned i = 0; i < keys.size(); i++) {
+      if ((rc = idx->insert(keys[i], rids[i], values[i])) < 0) {
+        fprintf(stderr, "Error: while inserting tuples into the index of table %s\n", table.c_str());
+        return rc;
+      }
     }
-    else if (min != -1 && condEQ) {
-      index.locate(min, cursor); // >= min
+  }
+
+  return 0;
+}
+
+/*
+ * a tuple of a load file while it is sorted
+ */
+typedef struct {
+  int    key;
+  string value;
+} LoadTuple;
+
+static bool keyLess(const LoadTuple& t1, const LoadTuple& t2)
+{
+  return t1.key < t2.key;
+}
+
+/*
+ * write a sorted run to a temporary file as [key][length][value bytes]...
+ */
+static RC writeRun(const vector<LoadTuple>& run, const string& filename)
+{
+  FILE* fp = fopen(filename.c_str(), "wb");
+  if (fp == NULL) return RC_FILE_OPEN_FAILED;
+
+  for (unsigned i = 0; i < run.size(); i++) {
+    int length = run[i].value.size();
+    if (fwrite(&run[i].key, sizeof(int), 1, fp) != 1 ||
+        fwrite(&length, sizeof(int), 1, fp) != 1 ||
+        fwrite(run[i].value.data(), 1, length, fp) != (size_t) length) {
+      fclose(fp);
+      return RC_FILE_WRITE_FAILED;
     }
-    else if (min != -1 && !condEQ) {
-      index.locate(min+1, cursor); // > min
+  }
+
+  return (fclose(fp) == 0) ? 0 : RC_FILE_WRITE_FAILED;
+}
+
+/*
+ * read the next tuple of a run written by writeRun().
+ * @return false at the end of the run
+ */
+static bool readRun(FILE* fp, LoadTuple& t)
+{
+  int length;
+  if (fread(&t.key, sizeof(int), 1, fp) != 1) return false;
+  if (fread(&length, sizeof(int), 1, fp) != 1 || length < 0) return false;
+
+  t.value.resize(length);
+  return length == 0 || fread(&t.value[0], 1, length, fp) == (size_t) length;
+}
+
+/*
+ * load the tuples of a load file in key order. the file is sorted in runs
+ * of SORT_RUN_SIZE tuples that are merged while the table is written, so
+ * files larger than memory can be sorted.
+ * @param f[IN] the open load file
+ * @param idx[IN] the index of the table. NULL if it has none
+ * @return error code. 0 if no error
+ */
+static RC loadSorted(ifstream& f, RecordFile& rf, BTreeIndex* idx, const string& table)
+{
+  RC                rc = 0;
+  string            line;
+  vector<LoadTuple> run;
+  vector<string>    runFiles;
+  vector<int>       keys;
+  vector<string>    values;
+
+  // cut the load file into sorted runs of SORT_RUN_SIZE tuples.
+  // all but the last one are written to temporary files.
+  // the sort is stable, so tuples with the same key keep their order.
+  LoadTuple t;
+  while (getline(f, line)) {
+    SqlEngine::parseLoadLine(line, t.key, t.value);
+    run.push_back(t);
+    if ((int) run.size() < SORT_RUN_SIZE) continue;
+
+    std::stable_sort(run.begin(), run.end(), keyLess);
+    char suffix[32];
+    sprintf(suffix, ".run%d", (int) runFiles.size());
+    runFiles.push_back(table + suffix);
+    if ((rc = writeRun(run, runFiles.back())) < 0) {
+      fprintf(stderr, "Error: cannot write sort run %s\n", runFiles.back().c_str());
+      goto remove_runs;
     }
-    else {
-      index.locate(0, cursor); // start at root
+    run.clear();
+  }
+  std::stable_sort(run.begin(), run.end(), keyLess);
+
+  if (runFiles.empty()) {
+    // the whole file fit in memory
+    for (unsigned i = 0; i < run.size(); i++) {
+      keys.push_back(run[i].key);
+      values.push_back(run[i].value);
+      if ((int) keys.size() == LOAD_BATCH_SIZE || i + 1 == run.size()) {
+        if ((rc = appendTuples(rf, idx, keys, values, table)) < 0) return rc;
+        keys.clear();
+        values.clear();
+      }
     }
-    // cout << "findKey: " << findKey << " hasVal: " << hasVal << endl;
-    // cout << "cursor: " << cursor.pid << ", " << cursor.eid << endl;
+    return 0;
+  }
 
-    // Read through index
-    while (index.readForward(cursor, key, rid) == 0) {
-      // If SELECT key or count(*), don't read from disk [attr 1 == key, 4 == count(*)]
-      if (!hasVal && (attr == 1 || attr == 4)) {
-        if (findKey != -1 && key != findKey) { // doesn't meet conditions
-          goto exit_to_print;
-        }
-        if (max != -1 && ((condEQ && key >= max) || (!condEQ && key > max))) {
-          goto exit_to_print;
-        }
-        if (min != -1 && ((condEQ && key <= min) || (!condEQ && key < min))) {
-          goto exit_to_print;
-        }
-        // print the tuples that match conditions
-        if (attr == 1) {
-          fprintf(stdout, "%d\n", key);
-        }
-        count++;
-        continue; // Skip the reading from the disk and continue the while loop
+  {
+    // merge the runs on disk with the last run in memory. ties go to the
+    // earlier run, which holds the tuples that came first in the file.
+    vector<FILE*>     fps(runFiles.size(), (FILE*) NULL);
+    vector<LoadTuple> heads(runFiles.size() + 1);
+    vector<bool>      live(runFiles.size() + 1, false);
+    unsigned          next = 0;  // the next tuple of the run in memory
+
+    for (unsigned r = 0; r < runFiles.size(); r++) {
+      fps[r] = fopen(runFiles[r].c_str(), "rb");
+      if (fps[r] == NULL) {
+        rc = RC_FILE_OPEN_FAILED;
+        break;
       }
-      else {
-        // hasVal, so need to read from disk
-        // cout << "sqlcursor: " << cursor.pid << ", " << cursor.eid << endl;
-        // cout << "key: " << key << " rid: " << rid.pid << endl;
-        if ((rc = rf.read(rid, key, value)) < 0) {
-          fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
-          goto exit_select;
-        }
-        // check the conditions on the tuple
-        for (unsigned i = 0; i < cond.size(); i++) {
-          // compute the difference between the tuple value and the condition value
-          switch (cond[i].attr) {
-            case 1:
-              diff = key - atoi(cond[i].value);
-              break;
-            case 2:
-              diff = strcmp(value.c_str(), cond[i].value);
-              break;
-          }
+      live[r] = readRun(fps[r], heads[r]);
+    }
+    if (rc == 0 && next < run.size()) {
+      heads[runFiles.size()] = run[next++];
+      live[runFiles.size()] = true;
+    }
 
-          // skip the tuple if any condition is not met
-          switch (cond[i].comp) {
-            case SelCond::EQ:
-              if (diff != 0) {
-                if (cond[i].attr == 1) {
-                  // Since keys are sorted, all tuples after won't match
-                  goto exit_to_print;
-                }
-                goto continue_while_loop; // If not key, then go on to next
-              }
-              break;
-            case SelCond::NE:
-              if (diff == 0) goto continue_while_loop;
-              break;
-            case SelCond::GT:
-              if (diff <= 0) goto continue_while_loop;
-              break;
-            case SelCond::LT:
-              if (diff >= 0) {
-                if (cond[i].attr == 1) {
-                  // Keys are sorted, so rest of keys will be greater
-                  goto exit_to_print;
-                }
-                goto continue_while_loop;
-              }
-              break;
-            case SelCond::GE:
-              if (diff < 0) goto continue_while_loop;
-              break;
-            case SelCond::LE:
-              if (diff >= 0) {
-                if (cond[i].attr == 1) {
-                  // Keys are sorted, so rest of keys will be greater
-                  goto exit_to_print;
-                }
-                goto continue_while_loop;
-              }
-              break;
-          }
-        }
+    while (rc == 0) {
+      int min = -1;
+      for (unsigned r = 0; r < heads.size(); r++) {
+        if (live[r] && (min < 0 || heads[r].key < heads[min].key)) min = r;
+      }
+      if (min < 0) break;
 
-        // the condition is met for the tuple.
-        // increase matching tuple counter
-        count++;
-
-        // print the tuple
-        switch (attr) {
-        case 1:  // SELECT key
-          fprintf(stdout, "%d\n", key);
-          break;
-        case 2:  // SELECT value
-          fprintf(stdout, "%s\n", value.c_str());
-          break;
-        case 3:  // SELECT *
-          fprintf(stdout, "%d '%s'\n", key, value.c_str());
-          break;
-        }
+      keys.push_back(heads[min].key);
+      values.push_back(heads[min].value);
+      if ((int) keys.size() == LOAD_BATCH_SIZE) {
+        rc = appendTuples(rf, idx, keys, values, table);
+        keys.clear();
+        values.clear();
+      }
 
-        continue_while_loop:
-          ;
+      if (min < (int) runFiles.size()) {
+        live[min] = readRun(fps[min], heads[min]);
+      } else if (next < run.size()) {
+        heads[min] = run[next++];
+      } else {
+        live[min] = false;
       }
     }
-  }
+    if (rc == 0 && !keys.empty()) {
+      rc = appendTuples(rf, idx, keys, values, table);
+    }
 
-  // print matching tuple count if "select count(*)"
-  exit_to_print: // exit when conditions are no longer met
-  if (attr == 4) {
-    fprintf(stdout, "%d\n", count);
+    for (unsigned r = 0; r < fps.size(); r++) {
+      if (fps[r] != NULL) fclose(fps[r]);
+    }
   }
-  rc = 0;
 
-  // close the table file and return
-  exit_select:
-  rf.close();
-  if (indexOpened) {
-    index.close();
+  remove_runs:
+  for (unsigned r = 0; r < runFiles.size(); r++) {
+    remove(runFiles[r].c_str());
   }
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, int options)
 {
   RC rc;
-  // Create RecordFile named table.tbl in working directory
+  bool index = (options & LOAD_INDEX) != 0;
+
+  // Create RecordFile named table.tbl in working directory.
+  // a columnar table also gets table.off and table.val for its values
   string tablename = table + ".tbl";
-  RecordFile rf(tablename, 'w'); // Will create and open RF
+  RecordFile rf;
+  rc = rf.open(tablename, 'w', (options & LOAD_COLUMNAR) ?
+               RecordFile::COLUMNAR_FORMAT : RecordFile::SLOTTED_FORMAT);
+  if (rc < 0) {
+    fprintf(stderr, "Error: cannot create table %s\n", table.c_str());
+    return rc;
+  }
 
   // Create BTreeIndex & file for index named table.idx in working directory
   BTreeIndex idx;
   if (index) {
     string indexname = table + ".idx";
-    rc = idx.open(indexname, 'w');
+    if ((rc = idx.open(indexname, 'w')) < 0) {
+      fprintf(stderr, "Error: cannot open the index of table %s\n", table.c_str());
+      rf.close();
+      return rc;
+    }
+    // a covering index keeps the values in its leaves as well. an index
+    // that already has entries cannot become one.
+    if ((options & LOAD_COVERING) && !idx.isCovering() &&
+        (rc = idx.setCovering(COVERING_VALUE_SIZE)) < 0) {
+      fprintf(stderr, "Error: table %s already has an index that is not covering\n", table.c_str());
+      idx.close();
+      rf.close();
+      return rc;
+    }
   }
 
-  RecordId rid;
+  // the snapshot of the table, if any, does not have the new tuples
+  remove((table + ".snap").c_str());
+
   int key;
   string value;
 
@@ -352,25 +1184,142 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   string in;
   ifstream f (loadfile.c_str());
 
-  if (f.is_open()) {
-    while (getline(f, in)) {
-      // Read tuple from input file use parseLoadLine
-      parseLoadLine(in, key, value);
-      rc = rf.append(key, value, rid);
-      // If index is true, insert corresponding tuple into B+Tree Index
-      if (index) {
-        rc = idx.insert(key, rid);
+  // train the dictionary of a compressed table on the beginning of the
+  // load file before any record is stored
+  if (f.is_open() && (options & LOAD_COMPRESSED)) {
+    vector<string> samples;
+    while ((int) samples.size() < DICTIONARY_SAMPLES && getline(f, in)) {
+      if (parseLoadLine(in, key, value) == 0) samples.push_back(value);
+    }
+    if (rf.compress(samples) < 0) {
+      fprintf(stderr, "Warning: table %s is not compressed: it already has tuples or is columnar\n", table.c_str());
+    }
+    f.clear();
+    f.seekg(0);
+  }
+
+  if (f.is_open() && (options & LOAD_CLUSTERED)) {
+    // a clustered table stores the tuples in key order
+    rc = loadSorted(f, rf, index ? &idx : NULL, table);
+    f.close();
+    if (index) {
+      RC irc = idx.close();
+      if (rc == 0) rc = irc;
+    }
+  }
+  else if (f.is_open()) {
+    vector<int>      keys;
+    vector<string>   values;
+    bool more = true;
+
+    // the tuples are appended LOAD_BATCH_SIZE at a time,
+    // so that every table page is written once
+    while (more) {
+      keys.clear();
+      values.clear();
+      while ((int) keys.size() < LOAD_BATCH_SIZE && (more = (bool) getline(f, in))) {
+        // Read tuple from input file use parseLoadLine
+        parseLoadLine(in, key, value);
+        keys.push_back(key);
+        values.push_back(value);
       }
+      if (keys.empty()) break;
+
+      if ((rc = appendTuples(rf, index ? &idx : NULL, keys, values, table)) < 0) break;
     }
     f.close();
     if (index) {
-      rc = idx.close(); // Close the file when done inserting index
+      RC irc = idx.close(); // Close the file when done inserting index
+      if (rc == 0) rc = irc;
     }
   }
 
+  // the table writes its header and its zone map when closed.
+  // if they are not written, the table reopens without the new tuples
+  // or without its zone map, so the load failed.
+  RC crc = rf.close();
+  if (crc < 0) {
+    fprintf(stderr, "Error: while closing table %s\n", table.c_str());
+  }
+  if (rc == 0) rc = crc;
+
   return rc; // Come back to how to implement RC
 }
 
+RC SqlEngine::rebuildIndex(const string& table, int fillPercent)
+{
+  RC rc;
+  BTreeIndex idx;
+  int before, after;
+
+  if (fillPercent < 1 || fillPercent > 100) {
+    fprintf(stderr, "Error: fill factor must be between 1 and 100\n");
+    return RC_INVALID_ATTRIBUTE;
+  }
+
+  // opening in write mode would create a missing index file
+  if ((rc = idx.open(table + ".idx", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s has no index\n", table.c_str());
+    return rc;
+  }
+  idx.close();
+
+  if ((rc = idx.open(table + ".idx", 'w')) < 0) {
+    fprintf(stderr, "Error: table %s has no index\n", table.c_str());
+    return rc;
+  }
+
+  if ((rc = idx.rebuild(fillPercent, before, after)) < 0) {
+    fprintf(stderr, "Error: while rebuilding the index of table %s\n", table.c_str());
+  } else {
+    fprintf(stdout, "Index of %s rebuilt: %d pages before, %d pages after\n",
+            table.c_str(), before, after);
+  }
+
+  idx.close();
+  return rc;
+}
+
+RC SqlEngine::exportSnapshot(const string& table)
+{
+  RC             rc;
+  RecordFile     rf;
+  vector<int>    keys;
+  vector<string> values;
+  const char*    data;
+  int            length;
+
+  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  // read every tuple of the table
+  RecordFile::Scanner scan(rf);
+  while ((rc = scan.nextPage()) == 0) {
+    for (int j = 0; j < scan.count(); j++) {
+      if ((rc = scan.value(j, data, length)) < 0) break;
+      keys.push_back(scan.keys()[j]);
+      values.push_back(string(data, length));
+    }
+    if (rc < 0) break;
+  }
+  rf.close();
+
+  if (rc != RC_END_OF_FILE) {
+    fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+    return rc;
+  }
+
+  if ((rc = SnapshotFile::write(table + ".snap", keys, values)) < 0) {
+    fprintf(stderr, "Error: cannot write the snapshot of table %s\n", table.c_str());
+    return rc;
+  }
+
+  fprintf(stdout, "Snapshot of %s written: %d tuples\n", table.c_str(), (int) keys.size());
+  return 0;
+}
+
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
 {
     const char *s;
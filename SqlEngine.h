@@ -13,16 +13,50 @@
 #include <vector>
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "ResultSink.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
  */
 struct SelCond {
-  int attr;     // attribute: 1 - key column,  2 - value column
+  int attr;     // attribute: 1 - key column,  2 - value column, 0 - an OR group
   enum Comparator { EQ, NE, LT, GT, LE, GE } comp;
-  char* value;  // the value to compare
+  char* value;  // the value to compare. NULL if compared with otherAttr
+  char* table;  // the table that qualifies attr, as in "movie.key". NULL if none
+  int otherAttr;     // the attribute compared with, as in "a.key = b.key"
+  char* otherTable;  // the table that qualifies otherAttr. NULL if none
+  // an OR group: the lists of conditions, ANDed within a list, of which
+  // the tuple must satisfy one. NULL unless attr is 0
+  std::vector<std::vector<SelCond> >* group;
 };
 
+/**
+ * data structure to represent an item in the SELECT clause
+ */
+struct SelItem {
+  enum Function { NONE, COUNT, MIN, MAX, SUM, AVG } func;  // NONE for a plain attribute
+  int attr;     // attribute: 1 - key column, 2 - value column, 3 - * (NONE and COUNT only)
+  char* table;  // the table that qualifies attr. NULL if none
+};
+
+/**
+ * the ORDER BY and LIMIT clauses of a SELECT statement
+ */
+struct SelOrder {
+  int attr;         // attribute: 1 - key column, 0 - no ORDER BY
+  bool descending;  // true for DESC
+  int limit;        // # rows to print at most. -1 if there is no LIMIT
+};
+
+/**
+ * options of the LOAD command. they can be ORed together.
+ */
+const int LOAD_INDEX    = 1;  // WITH INDEX
+const int LOAD_COVERING = 2;  // WITH COVERING INDEX: the index also stores the values
+const int LOAD_COLUMNAR = 4;  // COLUMNAR: store the key and value columns separately
+const int LOAD_COMPRESSED = 8; // COMPRESSED: encode the values with a trained dictionary
+const int LOAD_CLUSTERED = 16; // CLUSTERED: store the tuples sorted by key
+
 /**
  * the class that takes, parses, and executes the user commands.
  */
@@ -38,26 +72,86 @@ class SqlEngine {
    */
   static RC run(FILE* commandline);
 
+  /**
+   * send the rows of the following SELECT statements to a sink instead
+   * of printing them on screen.
+   * @param sink[IN] the sink, kept until it is replaced. NULL to print
+   * the rows on screen again
+   */
+  static void setResultSink(ResultSink* sink);
+
   /**
    * executes a SELECT statement.
-   * all conditions in conds must be ANDed together.
-   * the result of the SELECT is printed on screen.
-   * @param attr[IN] attribute in the SELECT clause
-   * (1: key, 2: value, 3: *, 4: count(*))
+   * the conditions of every list in conds must be ANDed together, and
+   * the lists ORed together. a condition may itself be an OR group of
+   * such lists, where multiplying it out would make too many lists.
+   * the result of the SELECT is printed on screen, or handed to the
+   * sink of setResultSink().
+   * the SELECT clause is either a single attribute or *, or a list of
+   * aggregates. with GROUP BY, it may also list the grouping attribute,
+   * and a row is printed per group.
+   * @param items[IN] the items in the SELECT clause
    * @param table[IN] the table name in the FROM clause
-   * @param conds[IN] list of conditions in the WHERE clause
+   * @param conds[IN] the WHERE clause as lists of conditions. empty if
+   * there is no WHERE clause
+   * @param groupBy[IN] attribute in the GROUP BY clause
+   * (1: key, 2: value, 0: no GROUP BY)
+   * @param order[IN] the ORDER BY and LIMIT clauses. the rows are read
+   * in key order and the scan stops after LIMIT rows when the index
+   * order matches, and are kept in a heap of LIMIT rows otherwise
    * @return error code. 0 if no error
    */
-  static RC select(int attr, const std::string& table, const std::vector<SelCond>& conds);
+  static RC select(const std::vector<SelItem>& items, const std::string& table,
+                   const std::vector<std::vector<SelCond> >& conds, int groupBy,
+                   const SelOrder& order);
+
+  /**
+   * executes a SELECT statement that joins two tables on their keys.
+   * every disjunct of the WHERE clause must have the condition
+   * a.key = b.key for the two tables a and b, and the ORed conditions
+   * can test the value of only one table. a condition on the key of
+   * either table applies to both. the SELECT clause lists the key,
+   * a.value and b.value, where * stands for all three, or is count(*).
+   * the rows are joined with the index of one table, with the indexes
+   * of both, or with a hash table, whichever reads the fewest pages.
+   * @param items[IN] the items in the SELECT clause
+   * @param left[IN] the first table in the FROM clause
+   * @param right[IN] the second table in the FROM clause
+   * @param conds[IN] the WHERE clause as in select()
+   * @param limit[IN] # rows to print at most. -1 if there is no LIMIT
+   * @return error code. 0 if no error
+   */
+  static RC join(const std::vector<SelItem>& items, const std::string& left,
+                 const std::string& right, const std::vector<std::vector<SelCond> >& conds,
+                 int limit);
 
   /**
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
-   * @param index[IN] true if "WITH INDEX" option was specified
+   * @param options[IN] the LOAD_* options that were specified, ORed together
+   * @return error code. 0 if no error
+   */
+  static RC load(const std::string& table, const std::string& loadfile, int options);
+
+  /**
+   * rebuild the index of a table to restore its fill factor and lay the
+   * leaves out contiguously in key order. prints the index size in pages
+   * before and after the rebuild.
+   * @param table[IN] the table name in the REBUILD INDEX command
+   * @param fillPercent[IN] how full the rebuilt nodes are made, in percent
+   * @return error code. 0 if no error
+   */
+  static RC rebuildIndex(const std::string& table, int fillPercent);
+
+  /**
+   * write a snapshot of a table: an immutable copy of its tuples in key
+   * order in a single file, table.snap, that SELECT reads through a
+   * memory map. a later LOAD into the table removes the snapshot.
+   * @param table[IN] the table name in the EXPORT SNAPSHOT command
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC exportSnapshot(const std::string& table);
 
   /**
    * parse a line from the load file into the (key, value) pair.
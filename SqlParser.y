@@ -1,19 +1,30 @@
 %{
 #include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <strings.h>
 #include <sys/times.h>
 #include <unistd.h>
 #include <climits>
 #include <string>
+#include <vector>
 #include "Bruinbase.h"
 #include "SqlEngine.h" 
 #include "PageFile.h"
+#include "BTreeNode.h"
 
 int  sqllex(void);  
 void sqlerror(const char *str) { fprintf(stderr, "Error: %s\n", str); }
 extern "C" { int  sqlwrap() { return 1; } }
 
-static void runSelect(int attr, const char* table, const std::vector<SelCond>& conds)
+typedef std::vector<std::vector<SelCond> > Disjuncts;
+
+// an AND of ORs is multiplied out into at most this many disjuncts.
+// past that, the ORs are kept as groups that every tuple is tested against
+static const unsigned MAX_DISJUNCTS = 64;
+
+static void runSelect(const std::vector<SelItem>& items, const std::vector<std::string>& tables,
+                      const Disjuncts& conds, int groupBy, const SelOrder& order)
 {
   struct tms tmsbuf;
   clock_t btime, etime;
@@ -21,31 +32,263 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
-  SqlEngine::select(attr, table, conds);
+  if (order.attr != 0 && order.attr != 1) {
+    fprintf(stderr, "Error: only ORDER BY key is supported\n");
+  } else if (tables.size() == 1) {
+    SqlEngine::select(items, tables[0], conds, groupBy, order);
+  } else if (tables.size() > 2) {
+    fprintf(stderr, "Error: at most two tables can be joined\n");
+  } else if (groupBy != 0) {
+    fprintf(stderr, "Error: GROUP BY is not supported in a join\n");
+  } else if (order.attr != 0) {
+    fprintf(stderr, "Error: ORDER BY is not supported in a join\n");
+  } else {
+    SqlEngine::join(items, tables[0], tables[1], conds, order.limit);
+  }
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
 
   fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
 }
 
+static char* copyString(const char* s)
+{
+  return (s == NULL) ? NULL : strdup(s);
+}
+
+/*
+ * parse an attribute name, qualified with a table name as in "movie.key"
+ * or not, into a condition that compares nothing yet. name is freed.
+ * @return NULL if the name is neither key nor value
+ */
+static SelCond* parseAttribute(char* name)
+{
+  SelCond* c = new SelCond;
+  char*    attr = strrchr(name, '.');
+
+  c->value = NULL;
+  c->table = NULL;
+  c->otherAttr = 0;
+  c->otherTable = NULL;
+  c->group = NULL;
+  if (attr != NULL) {
+    *attr++ = 0;
+    c->table = strdup(name);
+  } else {
+    attr = name;
+  }
+
+  if (strcasecmp(attr, "key") == 0) c->attr = 1;
+  else if (strcasecmp(attr, "value") == 0) c->attr = 2;
+  else {
+    free(c->table);
+    delete c;
+    c = NULL;
+  }
+  free(name);
+  return c;
+}
+
+static void freeDisjuncts(Disjuncts* d);
+
+/*
+ * free the strings and the OR group of a condition
+ */
+static void freeCond(SelCond& c)
+{
+  free(c.value);
+  free(c.table);
+  free(c.otherTable);
+  if (c.group != NULL) freeDisjuncts(c.group);
+}
+
+/*
+ * free the conditions and the lists
+ */
+static void freeDisjuncts(Disjuncts* d)
+{
+  for (unsigned i = 0; i < d->size(); i++) {
+    for (unsigned j = 0; j < (*d)[i].size(); j++) {
+      freeCond((*d)[i][j]);
+    }
+  }
+  delete d;
+}
+
+/*
+ * @return a copy of c with copies of its strings and its OR group
+ */
+static SelCond copyCond(const SelCond& c)
+{
+  SelCond copy = c;
+  copy.value = copyString(c.value);
+  copy.table = copyString(c.table);
+  copy.otherTable = copyString(c.otherTable);
+  if (c.group != NULL) {
+    copy.group = new Disjuncts(c.group->size());
+    for (unsigned i = 0; i < c.group->size(); i++) {
+      for (unsigned j = 0; j < (*c.group)[i].size(); j++) {
+        (*copy.group)[i].push_back(copyCond((*c.group)[i][j]));
+      }
+    }
+  }
+  return copy;
+}
+
+static bool sameString(const char* a, const char* b)
+{
+  return (a == NULL) ? b == NULL : b != NULL && strcmp(a, b) == 0;
+}
+
+/*
+ * @return the position of a condition in the list that is the same as c,
+ * which is not an OR group. -1 if there is none
+ */
+static int findCond(const std::vector<SelCond>& list, const SelCond& c)
+{
+  for (unsigned i = 0; i < list.size(); i++) {
+    const SelCond& o = list[i];
+    if (o.group == NULL && o.attr == c.attr && o.comp == c.comp &&
+        o.otherAttr == c.otherAttr && sameString(o.value, c.value) &&
+        sameString(o.table, c.table) && sameString(o.otherTable, c.otherTable)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+/*
+ * @return true if a condition of d is an OR group
+ */
+static bool hasGroups(const Disjuncts* d)
+{
+  for (unsigned i = 0; i < d->size(); i++) {
+    for (unsigned j = 0; j < (*d)[i].size(); j++) {
+      if ((*d)[i][j].group != NULL) return true;
+    }
+  }
+  return false;
+}
+
+/*
+ * AND the disjuncts of g with the conditions of conj as an OR group.
+ * the conditions that every disjunct has, such as the join condition,
+ * are taken out of the group and ANDed with conj directly. g is taken
+ * over.
+ */
+static void addGroup(std::vector<SelCond>& conj, Disjuncts* g)
+{
+  std::vector<SelCond>& first = (*g)[0];
+  for (unsigned i = 0; i < first.size(); ) {
+    bool common = (first[i].group == NULL);
+    for (unsigned d = 1; d < g->size() && common; d++) {
+      common = findCond((*g)[d], first[i]) >= 0;
+    }
+    if (!common) {
+      i++;
+      continue;
+    }
+    for (unsigned d = 1; d < g->size(); d++) {
+      std::vector<SelCond>& other = (*g)[d];
+      int k = findCond(other, first[i]);
+      freeCond(other[k]);
+      other.erase(other.begin() + k);
+    }
+    conj.push_back(first[i]);
+    first.erase(first.begin() + i);
+  }
+
+  // a single disjunct needs no group, and an empty one makes it true
+  bool always = false;
+  for (unsigned d = 0; d < g->size(); d++) {
+    always = always || (*g)[d].empty();
+  }
+  if (g->size() == 1) {
+    conj.insert(conj.end(), first.begin(), first.end());
+    delete g;
+  } else if (always) {
+    freeDisjuncts(g);
+  } else {
+    SelCond c;
+    c.attr = 0;
+    c.comp = SelCond::EQ;
+    c.value = c.table = c.otherTable = NULL;
+    c.otherAttr = 0;
+    c.group = g;
+    conj.push_back(c);
+  }
+}
+
+/*
+ * free the items and their table names
+ */
+static void freeItems(std::vector<SelItem>* items)
+{
+  for (unsigned i = 0; i < items->size(); i++) {
+    free((*items)[i].table);
+  }
+  delete items;
+}
+
+/*
+ * AND two WHERE clauses in disjunctive form: every disjunct of a is
+ * ANDed with every disjunct of b. if two ORs would multiply out into
+ * more than MAX_DISJUNCTS disjuncts, or an OR group would be copied into
+ * several of them, the result is a single disjunct that ANDs a and b as
+ * OR groups instead. a and b are freed or taken over.
+ */
+static Disjuncts* andDisjuncts(Disjuncts* a, Disjuncts* b)
+{
+  Disjuncts* d = new Disjuncts;
+  if ((a->size() > 1 && b->size() > 1 && a->size() * b->size() > MAX_DISJUNCTS) ||
+      (b->size() > 1 && hasGroups(a)) || (a->size() > 1 && hasGroups(b))) {
+    d->resize(1);
+    addGroup((*d)[0], a);
+    addGroup((*d)[0], b);
+    return d;
+  }
+
+  for (unsigned i = 0; i < a->size(); i++) {
+    for (unsigned j = 0; j < b->size(); j++) {
+      std::vector<SelCond> c;
+      for (unsigned k = 0; k < (*a)[i].size(); k++) c.push_back(copyCond((*a)[i][k]));
+      for (unsigned k = 0; k < (*b)[j].size(); k++) c.push_back(copyCond((*b)[j][k]));
+      d->push_back(c);
+    }
+  }
+  freeDisjuncts(a);
+  freeDisjuncts(b);
+  return d;
+}
+
 %}
 
 %union {
   int integer;
   char* string;
   SelCond* cond;
-  std::vector<SelCond>* conds;
+  std::vector<std::vector<SelCond> >* conds;
+  std::vector<char*>* values;
+  std::vector<std::string>* tables;
+  SelItem* item;
+  std::vector<SelItem>* items;
+  SelOrder order;
 }
 
-%token SELECT FROM WHERE LOAD WITH INDEX QUIT COUNT AND OR 
-%token COMMA STAR LF
+%token SELECT FROM WHERE LOAD WITH INDEX COVERING COLUMNAR COMPRESSED CLUSTERED REBUILD FILLFACTOR EXPORT SNAPSHOT QUIT COUNT MIN MAX SUM AVG GROUP BY IN ORDER ASC DESC LIMIT AND OR 
+%token COMMA STAR LPAREN RPAREN LF
 %token <string> INTEGER STRING ID
 %token EQUAL NEQUAL LESS LESSEQUAL GREATER GREATEREQUAL 
 
-%type <integer> attributes attribute comparator
+%type <integer> function group_option direction limit_option comparator load_options storage_options index_option
 %type <string> table value
-%type <cond> condition
-%type <conds> conditions
+%type <cond> condition attribute
+%type <tables> tables
+%type <conds> conditions conjunction primary
+%type <values> values
+%type <item> item
+%type <items> items
+%type <order> order_option
 %%
 
 commands:
@@ -56,6 +299,8 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| rebuild_command { fprintf(stdout, "Bruinbase> "); }
+	| export_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -66,70 +311,236 @@ quit_command:
 	;
 
 load_command:
-	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
+	LOAD table FROM STRING load_options LF { 
+	  SqlEngine::load(std::string($2), std::string($4), $5); 
 	  free($2);
 	  free($4);
 	}
-	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
-	  free($2);
-	  free($4);
+	;
+
+load_options:
+	storage_options index_option { $$ = $1 | $2; }
+	;
+
+storage_options:
+	/* no option */               { $$ = 0; }
+	| storage_options COLUMNAR   { $$ = $1 | LOAD_COLUMNAR; }
+	| storage_options COMPRESSED { $$ = $1 | LOAD_COMPRESSED; }
+	| storage_options CLUSTERED  { $$ = $1 | LOAD_CLUSTERED; }
+	;
+
+index_option:
+	/* no option */        { $$ = 0; }
+	| WITH INDEX          { $$ = LOAD_INDEX; }
+	| WITH COVERING INDEX { $$ = LOAD_INDEX | LOAD_COVERING; }
+	;
+
+rebuild_command:
+	REBUILD INDEX table LF {
+	  SqlEngine::rebuildIndex(std::string($3), REBUILD_FILL_PERCENT);
+	  free($3);
+	}
+	| REBUILD INDEX table FILLFACTOR INTEGER LF {
+	  SqlEngine::rebuildIndex(std::string($3), atoi($5));
+	  free($3);
+	  free($5);
+	}
+	;
+
+export_command:
+	EXPORT SNAPSHOT table LF {
+	  SqlEngine::exportSnapshot(std::string($3));
+	  free($3);
 	}
 	;
 
 select_command:
-	SELECT attributes FROM table LF {
-   	        std::vector<SelCond> conds;
-		runSelect($2, $4, conds);
-		free($4);
-	}
-	| SELECT attributes FROM table WHERE conditions LF {
-	        runSelect($2, $4, *$6);
-	  	free($4);
-	  	for (unsigned i = 0; i < $6->size(); i++) {
-		    free((*$6)[i].value);
-		}
-	  	delete $6;
+	SELECT items FROM tables group_option order_option limit_option LF {
+   	        Disjuncts conds;
+		$6.limit = $7;
+		runSelect(*$2, *$4, conds, $5, $6);
+		delete $4;
+		freeItems($2);
+	}
+	| SELECT items FROM tables WHERE conditions group_option order_option limit_option LF {
+		$8.limit = $9;
+	        runSelect(*$2, *$4, *$6, $7, $8);
+		delete $4;
+	  	freeDisjuncts($6);
+		freeItems($2);
+	}
+	;
+
+tables:
+	table {
+	  $$ = new std::vector<std::string>(1, $1);
+	  free($1);
+	}
+	| tables COMMA table {
+	  $1->push_back($3);
+	  $$ = $1;
+	  free($3);
+	}
+	;
+
+group_option:
+	/* no GROUP BY */      { $$ = 0; }
+	| GROUP BY attribute {
+	  $$ = $3->attr;
+	  free($3->table);
+	  delete $3;
+	}
+	;
+
+order_option:
+	/* no ORDER BY */ {
+	  $$.attr = 0;
+	  $$.descending = false;
+	}
+	| ORDER BY attribute direction {
+	  $$.attr = $3->attr;
+	  $$.descending = $4;
+	  free($3->table);
+	  delete $3;
+	}
+	;
+
+direction:
+	/* ascending */ { $$ = 0; }
+	| ASC           { $$ = 0; }
+	| DESC          { $$ = 1; }
+	;
+
+limit_option:
+	/* no LIMIT */ { $$ = -1; }
+	| LIMIT INTEGER {
+	  $$ = atoi($2);
+	  free($2);
+	  if ($$ < 0) {
+	    sqlerror("LIMIT must not be negative");
+	    YYERROR;
+	  }
 	}
 	;
 
 conditions:
+	conjunction { $$ = $1; }
+	| conditions OR conjunction {
+	  $1->insert($1->end(), $3->begin(), $3->end());
+	  $$ = $1;
+	  delete $3;
+	}
+	;
+
+conjunction:
+	primary { $$ = $1; }
+	| conjunction AND primary { $$ = andDisjuncts($1, $3); }
+	;
+
+primary:
 	condition {
-	  std::vector<SelCond>* v = new std::vector<SelCond>;
-	  v->push_back(*$1);
-	  $$ = v;
-          delete $1;
+	  $$ = new Disjuncts(1);
+	  (*$$)[0].push_back(*$1);
+	  delete $1;
 	}
-	| conditions AND condition {
-	  $1->push_back(*$3);
+	| attribute IN LPAREN values RPAREN {
+	  $$ = new Disjuncts($4->size());
+	  for (unsigned i = 0; i < $4->size(); i++) {
+	    SelCond c = *$1;
+	    c.comp = SelCond::EQ;
+	    c.value = (*$4)[i];
+	    c.table = copyString($1->table);
+	    (*$$)[i].push_back(c);
+	  }
+	  free($1->table);
+	  delete $1;
+	  delete $4;
+	}
+	| LPAREN conditions RPAREN { $$ = $2; }
+	;
+
+values:
+	value {
+	  $$ = new std::vector<char*>;
+	  $$->push_back($1);
+	}
+	| values COMMA value {
+	  $1->push_back($3);
 	  $$ = $1;
-          delete $3;
 	}
 	;
 
 condition:
 	attribute comparator value { 
-	  SelCond* c = new SelCond;
-	  c->attr = $1;
-	  c->comp = static_cast<SelCond::Comparator>($2);
-	  c->value = $3;
-	  $$ = c;
+	  $1->comp = static_cast<SelCond::Comparator>($2);
+	  $1->value = $3;
+	  $$ = $1;
         }
+	| attribute EQUAL attribute {
+	  $1->comp = SelCond::EQ;
+	  $1->otherAttr = $3->attr;
+	  $1->otherTable = $3->table;
+	  delete $3;
+	  $$ = $1;
+	}
+	;
+
+items:
+	item {
+	  std::vector<SelItem>* v = new std::vector<SelItem>;
+	  v->push_back(*$1);
+	  $$ = v;
+	  delete $1;
+	}
+	| items COMMA item {
+	  $1->push_back(*$3);
+	  $$ = $1;
+	  delete $3;
+	}
 	;
 
-attributes:
-	attribute { $$ = $1; }
-	| STAR  { $$ = 3; }
-	| COUNT { $$ = 4; }
+item:
+	attribute {
+	  $$ = new SelItem;
+	  $$->func = SelItem::NONE;
+	  $$->attr = $1->attr;
+	  $$->table = $1->table;
+	  delete $1;
+	}
+	| STAR {
+	  $$ = new SelItem;
+	  $$->func = SelItem::NONE;
+	  $$->attr = 3;
+	  $$->table = NULL;
+	}
+	| COUNT {
+	  $$ = new SelItem;
+	  $$->func = SelItem::COUNT;
+	  $$->attr = 3;
+	  $$->table = NULL;
+	}
+	| function LPAREN attribute RPAREN {
+	  $$ = new SelItem;
+	  $$->func = static_cast<SelItem::Function>($1);
+	  $$->attr = $3->attr;
+	  $$->table = $3->table;
+	  delete $3;
+	}
+	;
+
+function:
+	MIN   { $$ = SelItem::MIN; }
+	| MAX { $$ = SelItem::MAX; }
+	| SUM { $$ = SelItem::SUM; }
+	| AVG { $$ = SelItem::AVG; }
 	;
 
 attribute:
 	ID { 
-		if (strcasecmp($1, "key") == 0) $$=1;
-		else if (strcasecmp($1, "value") == 0) $$=2;
-		else sqlerror("wrong attribute name. neither key or value");
-		free($1);
+		if (($$ = parseAttribute($1)) == NULL) {
+		  sqlerror("wrong attribute name. neither key or value");
+		  YYERROR;
+		}
 	}
 
 value:
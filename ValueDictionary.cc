@@ -0,0 +1,185 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "ValueDictionary.h"
+#include <algorithm>
+#include <map>
+
+using std::string;
+using std::vector;
+using std::map;
+using std::pair;
+
+static const int FIRST_CODE = 0x80;
+
+// a token with bytes that need escaping is never matched
+static bool ascii(const string& s)
+{
+  for (unsigned i = 0; i < s.size(); i++) {
+    if ((unsigned char) s[i] >= FIRST_CODE) return false;
+  }
+  return true;
+}
+
+// candidates are ranked by the bytes they save: (length - 1) per occurrence
+static bool moreSaving(const pair<int, string>& a, const pair<int, string>& b)
+{
+  if (a.first != b.first) return a.first > b.first;
+  return a.second < b.second;
+}
+
+ValueDictionary::ValueDictionary()
+{
+}
+
+void ValueDictionary::train(const vector<string>& samples, int capacity)
+{
+  map<string, int> counts;
+  int used = 1;  // the byte that holds # tokens
+
+  tokens.clear();
+
+  // count every substring of a usable length
+  for (unsigned i = 0; i < samples.size(); i++) {
+    const string& s = samples[i];
+    for (unsigned p = 0; p < s.size(); p++) {
+      for (int n = MIN_TOKEN_LENGTH; n <= MAX_TOKEN_LENGTH && p + n <= s.size(); n++) {
+        counts[s.substr(p, n)]++;
+      }
+    }
+  }
+
+  vector< pair<int, string> > ranked;
+  for (map<string, int>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+    int saving = it->second * (it->first.size() - 1);
+    if (it->second > 1 && ascii(it->first)) ranked.push_back(pair<int, string>(saving, it->first));
+  }
+  std::sort(ranked.begin(), ranked.end(), moreSaving);
+
+  // take the best candidates. a candidate that lies inside a chosen token
+  // mostly occurs as part of it, so it is skipped unless it is also
+  // common on its own.
+  for (unsigned i = 0; i < ranked.size() && (int) tokens.size() < MAX_TOKENS; i++) {
+    const string& t = ranked[i].second;
+    int count = counts[t];
+    bool covered = false;
+    for (unsigned j = 0; j < tokens.size() && !covered; j++) {
+      if (tokens[j].find(t) != string::npos && count < 2 * counts[tokens[j]]) covered = true;
+    }
+    if (covered) continue;
+    if (used + 1 + (int) t.size() > capacity) continue;
+
+    tokens.push_back(t);
+    used += 1 + t.size();
+  }
+
+  index();
+}
+
+void ValueDictionary::write(char* buf) const
+{
+  *buf++ = (char) tokens.size();
+  for (unsigned i = 0; i < tokens.size(); i++) {
+    *buf++ = (char) tokens[i].size();
+    tokens[i].copy(buf, tokens[i].size());
+    buf += tokens[i].size();
+  }
+}
+
+RC ValueDictionary::read(const char* buf, int size)
+{
+  tokens.clear();
+  if (size <= 0) {
+    index();
+    return 0;
+  }
+
+  int count = (unsigned char) buf[0];
+  int pos = 1;
+  if (count > MAX_TOKENS) return RC_INVALID_FILE_FORMAT;
+
+  for (int i = 0; i < count; i++) {
+    if (pos >= size) return RC_INVALID_FILE_FORMAT;
+    int n = (unsigned char) buf[pos++];
+    if (n < 1 || pos + n > size) return RC_INVALID_FILE_FORMAT;
+    tokens.push_back(string(buf + pos, n));
+    pos += n;
+  }
+
+  index();
+  return 0;
+}
+
+int ValueDictionary::size() const
+{
+  int n = 1;
+  for (unsigned i = 0; i < tokens.size(); i++) {
+    n += 1 + tokens[i].size();
+  }
+  return n;
+}
+
+void ValueDictionary::encode(const string& value, string& out) const
+{
+  out.erase();
+  out.reserve(value.size());
+
+  for (unsigned p = 0; p < value.size(); ) {
+    unsigned char c = value[p];
+
+    // the longest token that matches here
+    const vector<int>& codes = byFirst[c];
+    int code = -1;
+    for (unsigned i = 0; i < codes.size(); i++) {
+      const string& t = tokens[codes[i]];
+      if (value.compare(p, t.size(), t) == 0) {
+        code = codes[i];
+        break;
+      }
+    }
+
+    if (code >= 0) {
+      out += (char) (FIRST_CODE + code);
+      p += tokens[code].size();
+    } else {
+      if (c >= FIRST_CODE) out += (char) ESCAPE;
+      out += (char) c;
+      p++;
+    }
+  }
+}
+
+void ValueDictionary::decode(const char* data, int len, string& value) const
+{
+  value.erase();
+
+  for (int p = 0; p < len; p++) {
+    unsigned char c = data[p];
+    if (c < FIRST_CODE) {
+      value += (char) c;
+    } else if (c == ESCAPE) {
+      if (++p < len) value += data[p];
+    } else if (c - FIRST_CODE < (int) tokens.size()) {
+      value += tokens[c - FIRST_CODE];
+    }
+  }
+}
+
+// group the codes by their first byte, longest token first
+void ValueDictionary::index()
+{
+  for (int i = 0; i < 256; i++) {
+    byFirst[i].clear();
+  }
+  for (int len = MAX_TOKEN_LENGTH; len >= 1; len--) {
+    for (unsigned i = 0; i < tokens.size(); i++) {
+      if ((int) tokens[i].size() == len) {
+        byFirst[(unsigned char) tokens[i][0]].push_back(i);
+      }
+    }
+  }
+}
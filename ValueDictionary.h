@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef VALUEDICTIONARY_H
+#define VALUEDICTIONARY_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * A dictionary of frequent substrings trained on the values of a table.
+ * Encoding replaces every dictionary token with a one-byte code, so the
+ * values of a text-heavy table take a fraction of their raw size. Bytes
+ * below 0x80 are stored as they are, codes use 0x80 to 0xFE and any
+ * other byte is escaped with ESCAPE.
+ */
+class ValueDictionary {
+ public:
+
+  static const int MAX_TOKENS = 127;       // codes 0x80 ... 0xFE
+  static const int MIN_TOKEN_LENGTH = 2;
+  static const int MAX_TOKEN_LENGTH = 8;
+  static const int ESCAPE = 0xFF;
+
+  ValueDictionary();
+
+  /**
+   * choose the tokens that save the most bytes over the sample values.
+   * @param samples[IN] values of the table
+   * @param capacity[IN] # bytes that the serialized dictionary may take
+   */
+  void train(const std::vector<std::string>& samples, int capacity);
+
+  /**
+   * serialize the dictionary.
+   * @param buf[OUT] buffer of at least size() bytes
+   */
+  void write(char* buf) const;
+
+  /**
+   * load a dictionary written by write().
+   * @param buf[IN] the serialized dictionary
+   * @param size[IN] # bytes in buf
+   * @return error code. 0 if no error
+   */
+  RC read(const char* buf, int size);
+
+  /**
+   * @return # bytes write() produces
+   */
+  int size() const;
+
+  /**
+   * @return true if the dictionary has no token
+   */
+  bool empty() const { return tokens.empty(); }
+
+  /**
+   * encode a value.
+   * @param value[IN] the value to encode
+   * @param out[OUT] the encoded bytes
+   */
+  void encode(const std::string& value, std::string& out) const;
+
+  /**
+   * decode a value encoded by encode().
+   * @param data[IN] the encoded bytes
+   * @param len[IN] # encoded bytes
+   * @param value[OUT] the decoded value
+   */
+  void decode(const char* data, int len, std::string& value) const;
+
+ private:
+  std::vector<std::string> tokens;          // token of code 0x80 + i
+  std::vector<int>         byFirst[256];    // codes by first byte, longest first
+
+  void index();
+};
+
+#endif // VALUEDICTIONARY_H